@@ -0,0 +1,144 @@
+// Emulador da SmartLamp sem hardware.
+//
+// O smartlamp.ino é compilado sem alterações contra os substitutos em mock/ e roda aqui: setup() uma vez e
+// loop() numa thread, com as tarefas do FreeRTOS em threads próprias. A serial passa por um enlace emulado
+// com velocidade, latência, jitter e falhas configuráveis, ligado:
+//   - ao driver smartlamp.ko, como um CP2102 (10c4:ea60) conectado pelo raw-gadget ao dummy_hcd; ou
+//   - à entrada e saída padrão (--stdio), para conversar direto com o firmware.
+//
+// Uso: sudo ./smartlamp-emulator [opções]    (veja --help)
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <thread>
+
+#include "emulator.h"
+
+// Definidas pelo smartlamp.ino
+void setup();
+void loop();
+
+// Equivalente ao laço principal do Arduino; dorme um pouco quando não há nada para ler
+static void sketchThread() {
+  setup();
+  for (;;) {
+    loop();
+    if (!hostToDevice.available())
+      std::this_thread::sleep_for(std::chrono::microseconds(50));
+  }
+}
+
+// Conversa com o firmware pelo terminal (e.g., digite "GET_LDR")
+int runStdio() {
+  std::thread input([] {
+    uint8_t buf[256];
+    ssize_t n;
+
+    while ((n = read(STDIN_FILENO, buf, sizeof(buf))) > 0)
+      hostToDevice.push(buf, n);
+    _exit(0);                              // sem destrutores: as outras threads seguem rodando
+  });
+  input.detach();
+
+  for (;;) {
+    uint8_t buf[256];
+    size_t n = deviceToHost.pop(buf, sizeof(buf), true);
+
+    if (n && write(STDOUT_FILENO, buf, n) < 0)
+      return 1;
+  }
+}
+
+static void usage(const char *prog) {
+  fprintf(stderr,
+          "Uso: %s [opcoes]\n"
+          "  --stdio               usa a entrada e saida padrao em vez do raw-gadget\n"
+          "  --udc-driver NOME     driver do UDC (padrao dummy_udc)\n"
+          "  --udc-device NOME     dispositivo do UDC (padrao dummy_udc.0)\n"
+          "  --latency-us N        atraso fixo de cada envio, em cada sentido\n"
+          "  --jitter-us N         atraso extra aleatorio (0 a N) de cada envio\n"
+          "  --no-throttle         nao limita a vazao a velocidade da serial\n"
+          "  --drop-rate P         probabilidade de perder cada byte\n"
+          "  --corrupt-rate P      probabilidade de inverter um bit de cada byte\n"
+          "  --dht-fail-rate P     probabilidade de uma leitura do DHT falhar\n"
+          "  --dht-delay-ms N      duracao de uma leitura do DHT (padrao 20)\n"
+          "  --ldr N               leitura media do ADC do LDR, 0 a 4095 (padrao 2048)\n"
+          "  --ldr-noise N         desvio padrao do ruido do ADC (padrao 40)\n"
+          "  --plant-gain N        leitura do LDR somada pelo LED no maximo (padrao 0)\n"
+          "  --plant-tau-ms N      constante de tempo da luz no LDR (padrao 200)\n"
+          "  --ambient-step N@MS   muda a luz ambiente em N leituras apos MS ms\n"
+          "  --clock-ppm N         deriva do relogio do ESP32 em partes por milhao (padrao 0)\n"
+          "  --temp T --hum H      temperatura e umidade (padrao 25.3 e 61)\n"
+          "  --seed N              semente das falhas e do ruido\n"
+          "  --verbose             mostra o trafego no stderr\n",
+          prog);
+}
+
+int main(int argc, char **argv) {
+  static const struct option options[] = {
+    { "stdio",         no_argument,       NULL, 's' },
+    { "udc-driver",    required_argument, NULL, 'D' },
+    { "udc-device",    required_argument, NULL, 'U' },
+    { "latency-us",    required_argument, NULL, 'l' },
+    { "jitter-us",     required_argument, NULL, 'j' },
+    { "no-throttle",   no_argument,       NULL, 'T' },
+    { "drop-rate",     required_argument, NULL, 'd' },
+    { "corrupt-rate",  required_argument, NULL, 'c' },
+    { "dht-fail-rate", required_argument, NULL, 'f' },
+    { "dht-delay-ms",  required_argument, NULL, 'F' },
+    { "ldr",           required_argument, NULL, 'L' },
+    { "ldr-noise",     required_argument, NULL, 'N' },
+    { "plant-gain",    required_argument, NULL, 'g' },
+    { "plant-tau-ms",  required_argument, NULL, 'u' },
+    { "ambient-step",  required_argument, NULL, 'a' },
+    { "clock-ppm",     required_argument, NULL, 'P' },
+    { "temp",          required_argument, NULL, 't' },
+    { "hum",           required_argument, NULL, 'H' },
+    { "seed",          required_argument, NULL, 'S' },
+    { "verbose",       no_argument,       NULL, 'v' },
+    { "help",          no_argument,       NULL, 'h' },
+    { NULL, 0, NULL, 0 }
+  };
+  const char *udcDriver = "dummy_udc", *udcDevice = "dummy_udc.0";
+  bool stdio = false;
+  int opt;
+
+  while ((opt = getopt_long(argc, argv, "", options, NULL)) != -1) {
+    switch (opt) {
+      case 's': stdio = true; break;
+      case 'D': udcDriver = optarg; break;
+      case 'U': udcDevice = optarg; break;
+      case 'l': emuConfig.latencyUs = strtoul(optarg, NULL, 0); break;
+      case 'j': emuConfig.jitterUs = strtoul(optarg, NULL, 0); break;
+      case 'T': emuConfig.throttle = false; break;
+      case 'd': emuConfig.dropRate = strtod(optarg, NULL); break;
+      case 'c': emuConfig.corruptRate = strtod(optarg, NULL); break;
+      case 'f': emuConfig.dhtFailRate = strtod(optarg, NULL); break;
+      case 'F': emuConfig.dhtDelayMs = strtoul(optarg, NULL, 0); break;
+      case 'L': emuConfig.ldrRaw = atoi(optarg); break;
+      case 'N': emuConfig.ldrNoise = atoi(optarg); break;
+      case 'g': emuConfig.plantGain = atoi(optarg); break;
+      case 'u': emuConfig.plantTauMs = strtoul(optarg, NULL, 0); break;
+      case 'a':
+        if (sscanf(optarg, "%d@%lu", &emuConfig.ambientStep, &emuConfig.ambientStepMs) != 2) {
+          usage(argv[0]);
+          return 1;
+        }
+        break;
+      case 'P': emuConfig.clockPpm = atoi(optarg); break;
+      case 't': emuConfig.temp = strtof(optarg, NULL); break;
+      case 'H': emuConfig.hum = strtof(optarg, NULL); break;
+      case 'S': emuConfig.seed = strtoul(optarg, NULL, 0); break;
+      case 'v': emuConfig.verbose = true; break;
+      default:
+        usage(argv[0]);
+        return opt == 'h' ? 0 : 1;
+    }
+  }
+
+  std::thread sketch(sketchThread);
+  sketch.detach();
+
+  return stdio ? runStdio() : runRawGadget(udcDriver, udcDevice);
+}
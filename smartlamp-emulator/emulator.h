@@ -0,0 +1,76 @@
+// Emulador da SmartLamp: o smartlamp.ino compilado no Linux, ligado ao driver por um dispositivo USB
+// emulado (raw-gadget + dummy_hcd) ou à entrada e saída padrão.
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+typedef std::chrono::steady_clock Clock;
+
+// Parâmetros do enlace e dos sensores emulados (opções da linha de comando)
+struct EmuConfig {
+  unsigned latencyUs = 0;     // Atraso fixo de cada envio, em cada sentido
+  unsigned jitterUs = 0;      // Atraso extra aleatório (0 a jitterUs) de cada envio
+  bool throttle = true;       // Limita a vazão à velocidade da serial (10 bits por byte)
+  double dropRate = 0;        // Probabilidade de perder cada byte
+  double corruptRate = 0;     // Probabilidade de inverter um bit de cada byte
+  double dhtFailRate = 0;     // Probabilidade de uma leitura do DHT falhar (NaN)
+  unsigned dhtDelayMs = 20;   // Duração de uma leitura do DHT
+  int ldrRaw = 2048;          // Leitura média do ADC do LDR (0 a 4095)
+  int ldrNoise = 40;          // Desvio padrão do ruído do ADC
+  int plantGain = 0;          // Planta: leitura do LDR somada com o LED no máximo (0: o LED não ilumina o LDR)
+  unsigned plantTauMs = 200;  // Constante de tempo da resposta do LDR ao LED e à luz ambiente
+  int ambientStep = 0;        // Degrau na luz ambiente (em leituras do ADC), aplicado em ambientStepMs
+  unsigned long ambientStepMs = 0;
+  int clockPpm = 0;           // Erro do cristal do ESP32: millis() e micros() adiantam (ou atrasam) N partes por milhão
+  float temp = 25.3f;         // Temperatura (graus)
+  float hum = 61.0f;          // Umidade (%)
+  unsigned seed = 1;          // Semente das falhas e do ruído
+  bool verbose = false;       // Mostra no stderr o tráfego e as mudanças do LED
+};
+
+extern EmuConfig emuConfig;
+
+// Um sentido da serial. Cada byte recebe o instante em que fica disponível do outro lado:
+// tempo de transmissão na velocidade atual, mais latência e jitter. Perdas e corrupção são aplicadas na entrada.
+class Link {
+public:
+  void push(const uint8_t *data, size_t len);
+  size_t pop(uint8_t *buf, size_t max, bool wait);  // Retira bytes já entregues (wait: bloqueia até haver algum)
+  size_t available();
+  int peek();
+  void drain();                                      // Espera o último byte terminar de ser transmitido
+  void close();                                      // Acorda quem espera em pop() (fim do emulador)
+
+private:
+  struct Byte {
+    Clock::time_point at;
+    uint8_t value;
+  };
+
+  std::mutex mutex;
+  std::condition_variable cond;
+  std::deque<Byte> queue;
+  Clock::time_point wireFree;                        // Fim da transmissão do último byte
+  bool closed = false;
+};
+
+extern Link hostToDevice;                            // Comandos do driver para o firmware
+extern Link deviceToHost;                            // Respostas do firmware para o driver
+
+// Velocidades das duas pontas da serial. Se a bridge está configurada numa velocidade diferente da do
+// firmware, os bytes chegam corrompidos, como no hardware. bridgeBaud 0 acompanha o firmware.
+extern std::atomic<unsigned long> firmwareBaud;
+extern std::atomic<unsigned long> bridgeBaud;
+
+double randomUniform();                              // [0, 1)
+double randomGauss();                                // Normal padrão
+
+int runStdio();
+int runRawGadget(const char *driver, const char *device);
+
+void emuLog(const char *fmt, ...) __attribute__((format(printf, 1, 2)));  // Mensagem no stderr se verbose
@@ -0,0 +1,18 @@
+#!/usr/bin/env python3
+# Converte o smartlamp.ino num arquivo C++ como o ambiente do Arduino faz: inclui o Arduino.h e declara
+# os protótipos de todas as funções antes da primeira definição.
+import re
+import sys
+
+src = open(sys.argv[1]).read()
+func = re.compile(r'^((?:static |const )*[A-Za-z_][\w<>:]*[ *&]+\w+\([^;{)]*\))\s*\{', re.M)
+protos = [m.group(1) + ';' for m in func.finditer(src)
+          if not m.group(1).split('(')[0].split()[-1] in ('if', 'while', 'for', 'switch')]
+first = func.search(src).start()
+
+out = sys.stdout if len(sys.argv) < 3 else open(sys.argv[2], 'w')
+out.write('#include "Arduino.h"\n#line 1 "%s"\n' % sys.argv[1])
+out.write(src[:first])
+out.write('\n'.join(protos) + '\n')
+out.write('#line %d "%s"\n' % (src[:first].count('\n') + 1, sys.argv[1]))
+out.write(src[first:])
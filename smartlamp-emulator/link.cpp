@@ -0,0 +1,126 @@
+// Enlace serial emulado e fontes de aleatoriedade do emulador
+#include <stdarg.h>
+#include <stdio.h>
+#include <random>
+#include <thread>
+
+#include "emulator.h"
+
+EmuConfig emuConfig;
+Link hostToDevice;
+Link deviceToHost;
+std::atomic<unsigned long> firmwareBaud(9600);
+std::atomic<unsigned long> bridgeBaud(0);
+
+static std::mutex randomLock;
+static std::mt19937 &generator() {
+  static std::mt19937 gen(emuConfig.seed);
+  return gen;
+}
+
+double randomUniform() {
+  std::lock_guard<std::mutex> lock(randomLock);
+  return std::uniform_real_distribution<double>(0, 1)(generator());
+}
+
+double randomGauss() {
+  std::lock_guard<std::mutex> lock(randomLock);
+  return std::normal_distribution<double>(0, 1)(generator());
+}
+
+void emuLog(const char *fmt, ...) {
+  va_list ap;
+
+  if (!emuConfig.verbose)
+    return;
+  va_start(ap, fmt);
+  vfprintf(stderr, fmt, ap);
+  va_end(ap);
+}
+
+void Link::push(const uint8_t *data, size_t len) {
+  std::lock_guard<std::mutex> lock(mutex);
+  Clock::time_point now = Clock::now();
+  unsigned long baud = firmwareBaud, bridge = bridgeBaud;
+  bool mismatch = bridge && bridge != baud;
+  std::chrono::nanoseconds byteTime(emuConfig.throttle ? 10000000000ULL / baud : 0);
+  std::chrono::microseconds delay(emuConfig.latencyUs);
+
+  if (emuConfig.jitterUs)
+    delay += std::chrono::microseconds((unsigned)(randomUniform() * emuConfig.jitterUs));
+  if (wireFree < now)
+    wireFree = now;
+
+  for (size_t i = 0; i < len; i++) {
+    uint8_t value = data[i];
+
+    wireFree += byteTime;
+    if (emuConfig.dropRate && randomUniform() < emuConfig.dropRate)
+      continue;
+    if (mismatch)
+      value = (uint8_t)(randomUniform() * 256);
+    if (emuConfig.corruptRate && randomUniform() < emuConfig.corruptRate)
+      value ^= 1 << (int)(randomUniform() * 8);
+    queue.push_back({ std::chrono::time_point_cast<Clock::duration>(wireFree + delay), value });
+  }
+  cond.notify_all();
+}
+
+size_t Link::pop(uint8_t *buf, size_t max, bool wait) {
+  std::unique_lock<std::mutex> lock(mutex);
+
+  for (;;) {
+    if (closed)
+      return 0;
+
+    if (!queue.empty()) {
+      Clock::time_point now = Clock::now();
+      size_t n = 0;
+
+      while (n < max && !queue.empty() && queue.front().at <= now) {
+        buf[n++] = queue.front().value;
+        queue.pop_front();
+      }
+      if (n || !wait)
+        return n;
+      cond.wait_until(lock, queue.front().at);
+    } else if (wait) {
+      cond.wait(lock);
+    } else {
+      return 0;
+    }
+  }
+}
+
+size_t Link::available() {
+  std::lock_guard<std::mutex> lock(mutex);
+  Clock::time_point now = Clock::now();
+  size_t n = 0;
+
+  while (n < queue.size() && queue[n].at <= now)
+    n++;
+  return n;
+}
+
+int Link::peek() {
+  std::lock_guard<std::mutex> lock(mutex);
+
+  if (queue.empty() || queue.front().at > Clock::now())
+    return -1;
+  return queue.front().value;
+}
+
+void Link::drain() {
+  Clock::time_point until;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    until = wireFree;
+  }
+  std::this_thread::sleep_until(until);
+}
+
+void Link::close() {
+  std::lock_guard<std::mutex> lock(mutex);
+  closed = true;
+  cond.notify_all();
+}
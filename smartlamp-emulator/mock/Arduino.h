@@ -0,0 +1,81 @@
+// Substitutos mínimos da API do Arduino-ESP32 e do FreeRTOS usados pelo smartlamp.ino,
+// para compilar o firmware no Linux (veja emulator.cpp).
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <mutex>
+#include <algorithm>
+
+#define INPUT  0x01
+#define OUTPUT 0x03
+#define ARDUINO_ISR_ATTR
+
+// Tempo e pinos
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void pinMode(uint8_t pin, uint8_t mode);
+void analogWrite(uint8_t pin, int value);
+int analogRead(uint8_t pin);
+long map(long x, long in_min, long in_max, long out_min, long out_max);
+uint32_t esp_random();
+
+inline bool isDigit(int c) { return isdigit(c) != 0; }
+using std::min;
+using std::max;
+
+// Porta serial: os bytes passam pelo enlace emulado (latência, velocidade e falhas configuráveis)
+class HardwareSerial {
+public:
+  void begin(unsigned long baud);
+  void updateBaudRate(unsigned long baud);
+  int available();
+  int read();
+  int peek();
+  void flush();
+
+  size_t write(uint8_t c) { return write(&c, 1); }
+  size_t write(const uint8_t *buf, size_t len);
+
+  size_t print(const char *s) { return write((const uint8_t *)s, strlen(s)); }
+  size_t print(char c) { return write((uint8_t)c); }
+  size_t print(int v) { return print((long)v); }
+  size_t print(unsigned int v) { return print((unsigned long)v); }
+  size_t print(long v);
+  size_t print(unsigned long v);
+  size_t print(double v, int digits = 2);
+
+  size_t println() { return print("\r\n"); }
+  template <typename T> size_t println(T v) { size_t n = print(v); return n + println(); }
+};
+
+extern HardwareSerial Serial;
+
+// FreeRTOS: tarefas viram threads e o tick é de 1 ms
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef void *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+#define pdFALSE         0
+#define pdTRUE          1
+#define portMAX_DELAY   0xffffffffUL
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+
+struct portMUX_TYPE {
+  std::mutex lock;
+};
+#define portMUX_INITIALIZER_UNLOCKED {}
+#define portENTER_CRITICAL(mux) (mux)->lock.lock()
+#define portEXIT_CRITICAL(mux)  (mux)->lock.unlock()
+
+TickType_t xTaskGetTickCount();
+void vTaskDelay(TickType_t ticks);
+void vTaskDelayUntil(TickType_t *previousWake, TickType_t period);
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack, void *arg,
+                                   unsigned priority, TaskHandle_t *handle, int core);
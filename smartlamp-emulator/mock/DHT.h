@@ -0,0 +1,18 @@
+// Substituto da biblioteca DHT: valores configuráveis com ruído, atraso de leitura e falhas (NaN)
+#pragma once
+
+#include "Arduino.h"
+
+#define DHT11 11
+#define DHT22 22
+
+class DHT {
+public:
+  DHT(uint8_t pin, uint8_t type) : pin(pin), type(type) {}
+  void begin() {}
+  float readTemperature();
+  float readHumidity();
+
+private:
+  uint8_t pin, type;
+};
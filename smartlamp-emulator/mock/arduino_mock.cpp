@@ -0,0 +1,170 @@
+// Implementação dos substitutos do Arduino-ESP32, do FreeRTOS e do DHT sobre o enlace emulado
+#include <stdio.h>
+#include <random>
+#include <thread>
+
+#include "Arduino.h"
+#include "DHT.h"
+#include "../emulator.h"
+
+HardwareSerial Serial;
+
+static const Clock::time_point bootTime = Clock::now();
+
+// Tempo desde o boot no relógio do ESP32, que se afasta do relógio real em emuConfig.clockPpm
+static int64_t deviceElapsedUs() {
+  int64_t us = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - bootTime).count();
+  return us + us * emuConfig.clockPpm / 1000000;
+}
+
+unsigned long millis() {
+  return deviceElapsedUs() / 1000;
+}
+
+unsigned long micros() {
+  return deviceElapsedUs();
+}
+
+void delay(unsigned long ms) {
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+void pinMode(uint8_t pin, uint8_t mode) {
+}
+
+static std::atomic<int> pwmDuty(0);   // Último PWM escrito (só o LED usa analogWrite)
+
+void analogWrite(uint8_t pin, int value) {
+  emuLog("[pino %u] PWM %d\n", pin, value);
+  pwmDuty = value;
+}
+
+// Planta simulada: a luz no LDR é a ambiente (--ldr, com o degrau de --ambient-step) mais a do LED
+// (--plant-gain no PWM máximo) e segue as mudanças com um atraso de primeira ordem (--plant-tau-ms).
+// Com ela o controle automático do firmware (AUTO) pode ser exercitado sem hardware.
+static double plantLight() {
+  static double light = -1;
+  static Clock::time_point last;
+  Clock::time_point now = Clock::now();
+  double target = emuConfig.ldrRaw + emuConfig.plantGain * pwmDuty / 255.0;
+
+  if (emuConfig.ambientStep && millis() >= emuConfig.ambientStepMs)
+    target += emuConfig.ambientStep;
+  if (light < 0 || emuConfig.plantTauMs == 0) {
+    light = target;
+  } else {
+    double dt = std::chrono::duration<double, std::milli>(now - last).count();
+    light += (target - light) * (1 - exp(-dt / emuConfig.plantTauMs));
+  }
+  last = now;
+  return light;
+}
+
+// ADC de 12 bits: leitura da planta com ruído gaussiano (chamada só pela tarefa do LDR)
+int analogRead(uint8_t pin) {
+  long value = lround(plantLight() + randomGauss() * emuConfig.ldrNoise);
+  return value < 0 ? 0 : value > 4095 ? 4095 : value;
+}
+
+long map(long x, long in_min, long in_max, long out_min, long out_max) {
+  return (x - in_min) * (out_max - out_min) / (in_max - in_min) + out_min;
+}
+
+// Gerador de hardware do ESP32: diferente a cada execução (não usa --seed), como um boot novo
+uint32_t esp_random() {
+  static std::random_device device;
+  return device();
+}
+
+// ---
+
+void HardwareSerial::begin(unsigned long baud) {
+  firmwareBaud = baud;
+}
+
+void HardwareSerial::updateBaudRate(unsigned long baud) {
+  emuLog("[serial] firmware a %lu baud\n", baud);
+  firmwareBaud = baud;
+}
+
+int HardwareSerial::available() {
+  return hostToDevice.available();
+}
+
+int HardwareSerial::read() {
+  uint8_t c;
+  return hostToDevice.pop(&c, 1, false) ? c : -1;
+}
+
+int HardwareSerial::peek() {
+  return hostToDevice.peek();
+}
+
+void HardwareSerial::flush() {
+  deviceToHost.drain();
+}
+
+size_t HardwareSerial::write(const uint8_t *buf, size_t len) {
+  deviceToHost.push(buf, len);
+  return len;
+}
+
+size_t HardwareSerial::print(long v) {
+  char buf[24];
+  return print((snprintf(buf, sizeof(buf), "%ld", v), buf));
+}
+
+size_t HardwareSerial::print(unsigned long v) {
+  char buf[24];
+  return print((snprintf(buf, sizeof(buf), "%lu", v), buf));
+}
+
+size_t HardwareSerial::print(double v, int digits) {
+  char buf[48];
+  if (isnan(v)) return print("nan");
+  if (isinf(v)) return print("inf");
+  return print((snprintf(buf, sizeof(buf), "%.*f", digits, v), buf));
+}
+
+// ---
+
+TickType_t xTaskGetTickCount() {
+  return (TickType_t)millis();
+}
+
+void vTaskDelay(TickType_t ticks) {
+  delay(ticks);
+}
+
+void vTaskDelayUntil(TickType_t *previousWake, TickType_t period) {
+  *previousWake += period;
+  std::this_thread::sleep_until(bootTime + std::chrono::milliseconds(*previousWake));
+}
+
+// Os dois núcleos do ESP32 viram threads comuns; núcleo e prioridade são ignorados
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack, void *arg,
+                                   unsigned priority, TaskHandle_t *handle, int core) {
+  std::thread task(fn, arg);
+  if (handle)
+    *handle = (TaskHandle_t)(uintptr_t)task.native_handle();
+  task.detach();
+  return pdTRUE;
+}
+
+// ---
+
+// A leitura do DHT11 ocupa a tarefa por alguns ms e às vezes falha
+static float dhtRead(float value, float noise) {
+  delay(emuConfig.dhtDelayMs);
+  if (emuConfig.dhtFailRate && randomUniform() < emuConfig.dhtFailRate)
+    return NAN;
+  return value + randomGauss() * noise;
+}
+
+float DHT::readTemperature() {
+  return dhtRead(emuConfig.temp, 0.1f);
+}
+
+float DHT::readHumidity() {
+  return dhtRead(emuConfig.hum, 0.5f);
+}
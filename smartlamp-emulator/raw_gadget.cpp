@@ -0,0 +1,347 @@
+// Transporte USB do emulador: apresenta o firmware ao kernel como um CP2102 (10c4:ea60) pelo raw-gadget.
+//
+// Com o dummy_hcd carregado (modprobe dummy_hcd raw_gadget), o dispositivo aparece no barramento USB
+// local e é associado ao smartlamp.ko como uma lâmpada de verdade. Os bytes do endpoint bulk OUT
+// entram no firmware pela serial emulada e o que o firmware escreve sai pelo endpoint bulk IN.
+// As requisições do fabricante do CP210x são aceitas e SET_BAUDRATE ajusta a velocidade da bridge.
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <thread>
+
+#include <linux/usb/ch9.h>
+#include <linux/usb/raw_gadget.h>
+
+#include "emulator.h"
+
+#define VENDOR_ID       0x10c4
+#define PRODUCT_ID      0xea60
+#define EP0_MAX_DATA    256
+#define BULK_MAX_PACKET 64     // O CP2102 é full-speed
+
+// Requisições do CP210x tratadas pelo emulador (AN571)
+#define CP210X_IFC_ENABLE   0x00
+#define CP210X_SET_LINE_CTL 0x03
+#define CP210X_SET_BAUDRATE 0x1E
+
+// As estruturas do raw-gadget terminam num vetor flexível, que o C++ não deixa embutir em outra
+// estrutura; o cabeçalho e os dados ficam num buffer único
+template <typename Header, size_t Size>
+struct RawBuffer {
+  alignas(Header) uint8_t raw[sizeof(Header) + Size];
+
+  Header *operator->() { return (Header *)raw; }
+  Header *get() { return (Header *)raw; }
+  uint8_t *data() { return raw + sizeof(Header); }
+  static constexpr size_t size = Size;
+};
+
+static int gadgetFd = -1;
+static struct usb_endpoint_descriptor epInDesc, epOutDesc;
+static int epIn = -1, epOut = -1;
+
+static const char *const strings[] = {
+  NULL,                                    // 0: idiomas
+  "Silicon Labs",
+  "CP2102 USB to UART Bridge Controller",
+  "SMARTLAMP-EMU",
+};
+
+// ---
+
+static int fillDeviceDescriptor(uint8_t *buf) {
+  struct usb_device_descriptor *desc = (struct usb_device_descriptor *)buf;
+
+  memset(desc, 0, USB_DT_DEVICE_SIZE);
+  desc->bLength = USB_DT_DEVICE_SIZE;
+  desc->bDescriptorType = USB_DT_DEVICE;
+  desc->bcdUSB = htole16(0x0110);
+  desc->bMaxPacketSize0 = 64;
+  desc->idVendor = htole16(VENDOR_ID);
+  desc->idProduct = htole16(PRODUCT_ID);
+  desc->bcdDevice = htole16(0x0100);
+  desc->iManufacturer = 1;
+  desc->iProduct = 2;
+  desc->iSerialNumber = 3;
+  desc->bNumConfigurations = 1;
+  return USB_DT_DEVICE_SIZE;
+}
+
+// Configuração única: uma interface de classe do fabricante com um endpoint bulk IN e um bulk OUT
+static int fillConfigDescriptor(uint8_t *buf) {
+  struct usb_config_descriptor *config = (struct usb_config_descriptor *)buf;
+  struct usb_interface_descriptor *iface = (struct usb_interface_descriptor *)(buf + USB_DT_CONFIG_SIZE);
+  int len = USB_DT_CONFIG_SIZE + USB_DT_INTERFACE_SIZE;
+
+  memset(buf, 0, len);
+  iface->bLength = USB_DT_INTERFACE_SIZE;
+  iface->bDescriptorType = USB_DT_INTERFACE;
+  iface->bNumEndpoints = 2;
+  iface->bInterfaceClass = USB_CLASS_VENDOR_SPEC;
+  iface->iInterface = 2;
+
+  memcpy(buf + len, &epInDesc, USB_DT_ENDPOINT_SIZE);
+  len += USB_DT_ENDPOINT_SIZE;
+  memcpy(buf + len, &epOutDesc, USB_DT_ENDPOINT_SIZE);
+  len += USB_DT_ENDPOINT_SIZE;
+
+  config->bLength = USB_DT_CONFIG_SIZE;
+  config->bDescriptorType = USB_DT_CONFIG;
+  config->wTotalLength = htole16(len);
+  config->bNumInterfaces = 1;
+  config->bConfigurationValue = 1;
+  config->bmAttributes = USB_CONFIG_ATT_ONE;
+  config->bMaxPower = 50;                  // 100 mA
+  return len;
+}
+
+// Descritor de string em UTF-16LE (apenas ASCII)
+static int fillStringDescriptor(uint8_t *buf, unsigned index) {
+  int len;
+
+  if (index == 0) {
+    buf[0] = 4;
+    buf[1] = USB_DT_STRING;
+    buf[2] = 0x09;                         // en-US
+    buf[3] = 0x04;
+    return 4;
+  }
+  if (index >= sizeof(strings) / sizeof(strings[0]))
+    return -1;
+
+  len = strlen(strings[index]);
+  buf[0] = 2 + 2 * len;
+  buf[1] = USB_DT_STRING;
+  for (int i = 0; i < len; i++) {
+    buf[2 + 2 * i] = strings[index][i];
+    buf[3 + 2 * i] = 0;
+  }
+  return buf[0];
+}
+
+// Escolhe os endpoints bulk do UDC (o dummy_udc tem endpoints de endereço fixo e outros livres)
+static void selectEndpoints() {
+  struct usb_raw_eps_info info;
+  int count;
+
+  memset(&info, 0, sizeof(info));
+  count = ioctl(gadgetFd, USB_RAW_IOCTL_EPS_INFO, &info);
+  if (count < 0) {
+    perror("USB_RAW_IOCTL_EPS_INFO");
+    exit(1);
+  }
+
+  memset(&epInDesc, 0, sizeof(epInDesc));
+  memset(&epOutDesc, 0, sizeof(epOutDesc));
+  for (int i = 0; i < count; i++) {
+    const struct usb_raw_ep_info *ep = &info.eps[i];
+    unsigned addr = ep->addr;
+
+    if (!ep->caps.type_bulk)
+      continue;
+    if (ep->caps.dir_in && !epInDesc.bLength) {
+      epInDesc.bEndpointAddress = USB_DIR_IN | (addr == USB_RAW_EP_ADDR_ANY ? 1 : addr);
+      epInDesc.bLength = USB_DT_ENDPOINT_SIZE;
+    } else if (ep->caps.dir_out && !epOutDesc.bLength &&
+               (addr == USB_RAW_EP_ADDR_ANY || addr != (epInDesc.bEndpointAddress & USB_ENDPOINT_NUMBER_MASK))) {
+      epOutDesc.bEndpointAddress = USB_DIR_OUT | (addr == USB_RAW_EP_ADDR_ANY ? 2 : addr);
+      epOutDesc.bLength = USB_DT_ENDPOINT_SIZE;
+    }
+  }
+  if (!epInDesc.bLength || !epOutDesc.bLength) {
+    fprintf(stderr, "UDC sem endpoints bulk suficientes\n");
+    exit(1);
+  }
+
+  for (struct usb_endpoint_descriptor *desc : { &epInDesc, &epOutDesc }) {
+    desc->bDescriptorType = USB_DT_ENDPOINT;
+    desc->bmAttributes = USB_ENDPOINT_XFER_BULK;
+    desc->wMaxPacketSize = htole16(BULK_MAX_PACKET);
+  }
+}
+
+// ---
+
+// Bulk OUT: comandos do driver entram na serial do firmware
+static void bulkOutThread() {
+  RawBuffer<struct usb_raw_ep_io, BULK_MAX_PACKET> io;
+
+  for (;;) {
+    io->ep = epOut;
+    io->flags = 0;
+    io->length = io.size;
+    int n = ioctl(gadgetFd, USB_RAW_IOCTL_EP_READ, io.get());
+    if (n < 0) {
+      perror("USB_RAW_IOCTL_EP_READ");
+      exit(1);
+    }
+    emuLog("[usb] <- %.*s", n, (const char *)io.data());
+    hostToDevice.push(io.data(), n);
+  }
+}
+
+// Bulk IN: o que o firmware escreve na serial vai para as URBs de leitura do driver
+static void bulkInThread() {
+  RawBuffer<struct usb_raw_ep_io, BULK_MAX_PACKET> io;
+
+  for (;;) {
+    size_t n = deviceToHost.pop(io.data(), io.size, true);
+    if (!n)
+      continue;
+    io->ep = epIn;
+    io->flags = 0;
+    io->length = n;
+    if (ioctl(gadgetFd, USB_RAW_IOCTL_EP_WRITE, io.get()) < 0) {
+      perror("USB_RAW_IOCTL_EP_WRITE");
+      exit(1);
+    }
+    emuLog("[usb] -> %.*s", (int)n, (const char *)io.data());
+  }
+}
+
+// SET_CONFIGURATION: habilita os endpoints e inicia as threads de transferência (só na primeira vez)
+static void configure() {
+  if (epIn >= 0)
+    return;
+
+  epIn = ioctl(gadgetFd, USB_RAW_IOCTL_EP_ENABLE, &epInDesc);
+  epOut = ioctl(gadgetFd, USB_RAW_IOCTL_EP_ENABLE, &epOutDesc);
+  if (epIn < 0 || epOut < 0) {
+    perror("USB_RAW_IOCTL_EP_ENABLE");
+    exit(1);
+  }
+  ioctl(gadgetFd, USB_RAW_IOCTL_VBUS_DRAW, 50);
+  ioctl(gadgetFd, USB_RAW_IOCTL_CONFIGURE, 0);
+
+  std::thread(bulkOutThread).detach();
+  std::thread(bulkInThread).detach();
+  fprintf(stderr, "SmartLamp emulada conectada (endpoints 0x%02x e 0x%02x)\n",
+          epInDesc.bEndpointAddress, epOutDesc.bEndpointAddress);
+}
+
+// Requisição de controle do fabricante já com os dados recebidos (CP210x)
+static void vendorRequest(const struct usb_ctrlrequest *ctrl, const uint8_t *data, int len) {
+  switch (ctrl->bRequest) {
+    case CP210X_SET_BAUDRATE:
+      if (len >= 4) {
+        bridgeBaud = data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+        emuLog("[cp210x] bridge a %lu baud\n", bridgeBaud.load());
+      }
+      break;
+    case CP210X_IFC_ENABLE:
+    case CP210X_SET_LINE_CTL:
+    default:
+      emuLog("[cp210x] requisicao 0x%02x valor 0x%04x\n", ctrl->bRequest, le16toh(ctrl->wValue));
+      break;
+  }
+}
+
+// Trata uma requisição no endpoint 0; o que não é conhecido recebe STALL
+static void controlRequest(const struct usb_ctrlrequest *ctrl) {
+  RawBuffer<struct usb_raw_ep_io, EP0_MAX_DATA> io;
+  uint8_t *data = io.data();
+  unsigned value = le16toh(ctrl->wValue), length = le16toh(ctrl->wLength);
+  int len = -1;
+
+  io->ep = 0;
+  io->flags = 0;
+  memset(data, 0, io.size);
+
+  switch (ctrl->bRequestType & USB_TYPE_MASK) {
+    case USB_TYPE_STANDARD:
+      switch (ctrl->bRequest) {
+        case USB_REQ_GET_DESCRIPTOR:
+          switch (value >> 8) {
+            case USB_DT_DEVICE: len = fillDeviceDescriptor(data); break;
+            case USB_DT_CONFIG: len = fillConfigDescriptor(data); break;
+            case USB_DT_STRING: len = fillStringDescriptor(data, value & 0xff); break;
+          }
+          break;
+        case USB_REQ_SET_CONFIGURATION:
+          configure();
+          len = 0;
+          break;
+        case USB_REQ_GET_CONFIGURATION:
+          data[0] = epIn >= 0;
+          len = 1;
+          break;
+        case USB_REQ_GET_STATUS:
+          len = 2;
+          break;
+        case USB_REQ_SET_INTERFACE:
+          len = 0;
+          break;
+      }
+      break;
+    case USB_TYPE_VENDOR:
+      // Leituras do CP210x respondem zeros; escritas são tratadas depois de receber os dados
+      len = (ctrl->bRequestType & USB_DIR_IN) ? (int)length : 0;
+      break;
+  }
+
+  if (len < 0 || len > EP0_MAX_DATA || length > EP0_MAX_DATA) {
+    ioctl(gadgetFd, USB_RAW_IOCTL_EP0_STALL, 0);
+    return;
+  }
+
+  if (ctrl->bRequestType & USB_DIR_IN) {
+    io->length = (unsigned)len < length ? len : length;
+    if (ioctl(gadgetFd, USB_RAW_IOCTL_EP0_WRITE, io.get()) < 0)
+      perror("USB_RAW_IOCTL_EP0_WRITE");
+  } else {
+    io->length = length;
+    int n = ioctl(gadgetFd, USB_RAW_IOCTL_EP0_READ, io.get());
+    if (n < 0)
+      perror("USB_RAW_IOCTL_EP0_READ");
+    else if ((ctrl->bRequestType & USB_TYPE_MASK) == USB_TYPE_VENDOR)
+      vendorRequest(ctrl, data, n);
+  }
+}
+
+int runRawGadget(const char *driver, const char *device) {
+  struct usb_raw_init init;
+
+  gadgetFd = open("/dev/raw-gadget", O_RDWR);
+  if (gadgetFd < 0) {
+    perror("/dev/raw-gadget (modprobe dummy_hcd raw_gadget?)");
+    return 1;
+  }
+
+  memset(&init, 0, sizeof(init));
+  snprintf((char *)init.driver_name, sizeof(init.driver_name), "%s", driver);
+  snprintf((char *)init.device_name, sizeof(init.device_name), "%s", device);
+  init.speed = USB_SPEED_FULL;
+  if (ioctl(gadgetFd, USB_RAW_IOCTL_INIT, &init) < 0 || ioctl(gadgetFd, USB_RAW_IOCTL_RUN, 0) < 0) {
+    perror("raw-gadget");
+    return 1;
+  }
+
+  // A bridge começa na velocidade inicial do firmware até o driver configurá-la
+  bridgeBaud = 9600;
+
+  for (;;) {
+    RawBuffer<struct usb_raw_event, sizeof(struct usb_ctrlrequest)> event;
+
+    event->type = 0;
+    event->length = event.size;
+    if (ioctl(gadgetFd, USB_RAW_IOCTL_EVENT_FETCH, event.get()) < 0) {
+      perror("USB_RAW_IOCTL_EVENT_FETCH");
+      return 1;
+    }
+
+    switch (event->type) {
+      case USB_RAW_EVENT_CONNECT:
+        selectEndpoints();
+        break;
+      case USB_RAW_EVENT_CONTROL:
+        controlRequest((const struct usb_ctrlrequest *)event.data());
+        break;
+      default:
+        break;
+    }
+  }
+}
@@ -0,0 +1,91 @@
+#!/usr/bin/env python3
+# Teste do controle automático (AUTO) contra a planta simulada do emulador, sem hardware nem driver.
+# Liga o controle, acompanha o LDR com GET_AUTO e verifica:
+#   - acomodação: o LDR entra na faixa do setpoint em até SETTLE_MAX_S e fica nela até o degrau;
+#   - rejeição do degrau: o degrau na luz ambiente tira o LDR da faixa e o controle o traz de volta
+#     em até RECOVER_MAX_S, sem sair de novo até o fim.
+#
+# Uso: ./test_auto.py [caminho do smartlamp-emulator]    (também com "make check")
+import subprocess
+import sys
+import threading
+import time
+
+SETPOINT = 50
+TOLERANCE = 2.5          # Faixa aceita em torno do setpoint (escala do LDR)
+STEP = 800               # Degrau na luz ambiente (leituras do ADC)
+STEP_AT_MS = 5000        # Instante do degrau, em millis() do emulador
+SETTLE_MAX_S = 4.0
+RECOVER_MAX_S = 4.0
+HOLD_S = 2.0             # Tempo acompanhado depois da recuperação
+POLL_S = 0.05
+
+emulator = sys.argv[1] if len(sys.argv) > 1 else './smartlamp-emulator'
+proc = subprocess.Popen([emulator, '--stdio', '--seed', '1', '--ldr', '1000', '--plant-gain', '2500',
+                         '--plant-tau-ms', '300', '--ambient-step', '%d@%d' % (STEP, STEP_AT_MS)],
+                        stdin=subprocess.PIPE, stdout=subprocess.PIPE, text=True, bufsize=1)
+start = time.monotonic()           # millis() do emulador conta a partir daqui (com a folga do exec)
+samples = []                       # (segundos desde o início, LDR)
+replies = []
+
+
+def reader():
+    for line in proc.stdout:
+        fields = line.split()
+        if fields[:2] == ['RES', 'GET_AUTO'] and len(fields) == 12:
+            samples.append((time.monotonic() - start, float(fields[9])))
+        else:
+            replies.append(line.strip())
+
+
+def send(cmd):
+    proc.stdin.write(cmd + '\n')
+    proc.stdin.flush()
+
+
+def fail(msg):
+    print('FALHOU: ' + msg)
+    proc.kill()
+    sys.exit(1)
+
+
+threading.Thread(target=reader, daemon=True).start()
+time.sleep(0.3)
+send('SET_AUTO %d 500 2000 1 0 100' % SETPOINT)
+send('AUTO 1')
+enabled = time.monotonic() - start
+
+step = STEP_AT_MS / 1000.0
+end = step + RECOVER_MAX_S + HOLD_S
+while time.monotonic() - start < end:
+    send('GET_AUTO')
+    time.sleep(POLL_S)
+proc.kill()
+
+if 'RES AUTO 1' not in replies or not samples:
+    fail('o firmware nao aceitou AUTO (%s)' % replies)
+
+
+def inside(ldr):
+    return abs(ldr - SETPOINT) <= TOLERANCE
+
+
+# Acomodação: último instante fora da faixa antes do degrau
+before = [(t, ldr) for t, ldr in samples if t < step]
+outside = [t for t, ldr in before if not inside(ldr)]
+settled = (outside[-1] if outside else before[0][0]) - enabled
+if not before or not inside(before[-1][1]) or settled > SETTLE_MAX_S:
+    fail('acomodacao em %.2f s (maximo %.1f s)' % (settled, SETTLE_MAX_S))
+print('acomodacao: %.2f s' % settled)
+
+# Rejeição do degrau: o LDR precisa sair da faixa e voltar a ela antes de RECOVER_MAX_S
+after = [(t, ldr) for t, ldr in samples if t >= step]
+peak = max(abs(ldr - SETPOINT) for t, ldr in after)
+outside = [t for t, ldr in after if not inside(ldr)]
+if not outside:
+    fail('o degrau nao tirou o LDR da faixa (desvio maximo %.2f)' % peak)
+recovered = outside[-1] - step
+if recovered > RECOVER_MAX_S or after[-1][0] - outside[-1] < HOLD_S:
+    fail('recuperacao do degrau em %.2f s (maximo %.1f s)' % (recovered, RECOVER_MAX_S))
+print('degrau: desvio maximo %.2f, recuperado em %.2f s' % (peak, recovered))
+print('OK')
@@ -1,162 +1,366 @@
 #include <linux/module.h>
-#include <linux/usb.h>
 #include <linux/slab.h>
 #include <linux/configfs.h>
 #include <linux/init.h>
-#include <linux/uaccess.h>
+#include <linux/kernel.h>
+#include <linux/jiffies.h>
+#include <linux/mutex.h>
+#include <linux/seqlock.h>
+#include <linux/workqueue.h>
+#include <linux/moduleparam.h>
+#include <linux/sysfs.h>
+
+#include "smartlamp.h"
 
 MODULE_AUTHOR("DevTITANS <devtitans@icomp.ufam.edu.br>");
 MODULE_DESCRIPTION("SmartLamp USB Driver via ConfigFS");
 MODULE_LICENSE("GPL");
 
-#define VENDOR_ID   0x10c4
-#define PRODUCT_ID  0xea60
-#define MAX_RECV_LINE 100
+// Os comandos vão pelo transporte do smartlamp.ko (smartlamp.h), que precisa estar carregado: este módulo
+// não registra um driver USB próprio, só os grupos /sys/kernel/config/smartlamp/{led, ldr, dht}.
+
+#define GROUP_MAX_SENSORS 2 // Sensores lidos juntos por um grupo (temperatura e umidade no dht)
+
+// Lâmpada acessada pelos grupos
+static int lamp;
+module_param(lamp, int, S_IRUGO);
+MODULE_PARM_DESC(lamp, "Lampada (N em /sys/kernel/smartlamp/lampN) acessada pelo configfs");
+
+// Descritor de um grupo: sensores lidos a cada amostragem e a política inicial.
+// Sensores lentos (DHT) são amostrados raramente e o LDR com frequência, cada um no seu ritmo.
+struct smartlamp_group_desc {
+    const char                   *name;           // Diretório criado com mkdir
+    const struct config_item_type *type;          // Atributos do grupo
+    enum smartlamp_sensor         sensors[GROUP_MAX_SENSORS];
+    int                           nsensors;
+    unsigned int                  period_ms;      // Período inicial do amostrador (0 desligado)
+    unsigned int                  max_age_ms;     // Idade máxima inicial de um valor servido (0 lê sempre na hora)
+};
+
+// Grupo criado com mkdir: guarda a última leitura dos seus sensores e a política de amostragem.
+// As leituras seguem o mesmo esquema do snapshot do smartlamp.c: o show lê o cache sem bloquear e só vai
+// à lâmpada quando o valor é mais velho que max_age_ms.
+struct smartlamp_item {
+    struct config_group                group;
+    const struct smartlamp_group_desc *desc;
+    long                               value[GROUP_MAX_SENSORS]; // Última leitura, na ordem de desc->sensors
+    unsigned long                      valid;          // Bit i ligado se value[i] foi lido com sucesso
+    unsigned long                      stamp;          // jiffies da última leitura (0 nunca lido)
+    seqlock_t                          cache_lock;     // Protege value, valid e stamp
+    struct mutex                       refresh_mutex;  // Evita leituras simultâneas dos mesmos sensores
+    struct delayed_work                sampler_work;   // Amostrador do grupo
+    unsigned int                       period_ms;      // Período do amostrador (0 desligado)
+    unsigned int                       max_age_ms;     // Idade máxima de um valor servido pelo show
+    bool                               running;        // Falso a partir do rmdir
+};
+
+static inline struct smartlamp_item *to_smartlamp_item(struct config_item *item) {
+    return container_of(to_config_group(item), struct smartlamp_item, group);
+}
 
-static struct usb_device *smartlamp_device;
-static uint usb_in, usb_out;
-static char *usb_in_buffer, *usb_out_buffer;
-static int usb_max_size;
+// ---
 
-static int smartlamp_send_command(const char *cmd, char *response, int response_len) {
-    int actual_size;
+// Lê os sensores do grupo na lâmpada e atualiza o cache. Chamada com refresh_mutex adquirido.
+// Grupos com mais de um sensor (dht) usam uma única transação para todos, em vez de um GET por sensor.
+// Sem a lâmpada o cache fica como está (e logo velho), para a próxima leitura tentar de novo.
+static int item_refresh(struct smartlamp_item *it) {
+    long value[GROUP_MAX_SENSORS], all[SENSOR_COUNT];
+    unsigned long valid = 0, all_valid;
+    struct smartlamp *dev;
+    int i;
 
-    if (!smartlamp_device)
+    dev = smartlamp_get(lamp);
+    if (!dev)
         return -ENODEV;
 
-    memset(usb_out_buffer, 0, usb_max_size);
-    strncpy(usb_out_buffer, cmd, usb_max_size - 1);
+    if (it->desc->nsensors > 1) {
+        if (smartlamp_read_all(dev, all, &all_valid) == 0) {
+            for (i = 0; i < it->desc->nsensors; i++) {
+                value[i] = all[it->desc->sensors[i]];
+                if (all_valid & BIT(it->desc->sensors[i]))
+                    valid |= BIT(i);
+            }
+        }
+    } else if (smartlamp_read(dev, it->desc->sensors[0], &value[0]) == 0) {
+        valid = BIT(0);
+    }
+    smartlamp_put(dev);
+
+    write_seqlock(&it->cache_lock);
+    for (i = 0; i < it->desc->nsensors; i++)
+        if (valid & BIT(i))
+            it->value[i] = value[i];
+    it->valid = valid;
+    it->stamp = jiffies ?: 1;      // stamp 0 indica cache nunca preenchido
+    write_sequnlock(&it->cache_lock);
 
-    usb_bulk_msg(smartlamp_device, usb_sndbulkpipe(smartlamp_device, usb_out),
-                 usb_out_buffer, strlen(usb_out_buffer), &actual_size, 1000);
+    return valid ? 0 : -EIO;
+}
 
-    memset(usb_in_buffer, 0, usb_max_size);
-    usb_bulk_msg(smartlamp_device, usb_rcvbulkpipe(smartlamp_device, usb_in),
-                 usb_in_buffer, usb_max_size, &actual_size, 1000);
+// Lê um sensor do cache sem bloquear; stamp recebe o jiffies da leitura (0 se nunca lido)
+static int item_cache_peek(struct smartlamp_item *it, int i, long *value, unsigned long *stamp) {
+    unsigned long valid;
+    unsigned int seq;
 
-    if (response && response_len > 0)
-        strncpy(response, usb_in_buffer, response_len - 1);
+    do {
+        seq = read_seqbegin(&it->cache_lock);
+        *value = it->value[i];
+        valid = it->valid;
+        *stamp = it->stamp;
+    } while (read_seqretry(&it->cache_lock, seq));
 
-    return 0;
+    return (valid & BIT(i)) ? 0 : -EIO;
 }
 
-// ======================= ConfigFS =======================
-#include <linux/configfs.h>
+// Lê um sensor do cache: -ESTALE se o valor é mais velho que max_age_ms
+static int item_cache_read(struct smartlamp_item *it, int i, long *value) {
+    unsigned long stamp;
+    int ret = item_cache_peek(it, i, value, &stamp);
 
-struct smartlamp_item {
-    struct config_group item;
+    if (!stamp || time_after(jiffies, stamp + msecs_to_jiffies(READ_ONCE(it->max_age_ms))))
+        return -ESTALE;
+    return ret;
+}
+
+// Obtém um sensor do grupo: do cache se estiver atualizado, senão lê na lâmpada.
+// Apenas um leitor vai à lâmpada; os demais esperam e aproveitam o resultado.
+static int item_get(struct smartlamp_item *it, int i, long *value) {
+    unsigned long stamp;
+    int ret = item_cache_read(it, i, value);
+
+    if (ret != -ESTALE)
+        return ret;
+
+    mutex_lock(&it->refresh_mutex);
+    ret = item_cache_read(it, i, value);
+    if (ret == -ESTALE) {
+        ret = item_refresh(it);
+        // O valor acabou de ser lido: serve mesmo com max_age_ms 0
+        if (ret != -ENODEV)
+            ret = item_cache_peek(it, i, value, &stamp);
+    }
+    mutex_unlock(&it->refresh_mutex);
+    return ret;
+}
+
+// Amostrador do grupo: lê os sensores e se reagenda conforme period_ms
+static void item_sampler_fn(struct work_struct *work) {
+    struct smartlamp_item *it = container_of(to_delayed_work(work), struct smartlamp_item, sampler_work);
+    unsigned int period = READ_ONCE(it->period_ms);
+
+    if (!READ_ONCE(it->running) || !period)
+        return;
+
+    mutex_lock(&it->refresh_mutex);
+    item_refresh(it);
+    mutex_unlock(&it->refresh_mutex);
+
+    if (READ_ONCE(it->running))
+        schedule_delayed_work(&it->sampler_work, msecs_to_jiffies(period));
+}
+
+// Escreve o valor do sensor i do grupo no formato do sysfs
+static ssize_t item_show(struct config_item *item, int i, char *buf) {
+    struct smartlamp_item *it = to_smartlamp_item(item);
+    long value;
+    int ret, len;
+
+    ret = item_get(it, i, &value);
+    if (ret < 0)
+        return ret == -ENODEV ? -ENODEV : -EIO;
+
+    len = smartlamp_format(buf, it->desc->sensors[i], value);
+    return len + sysfs_emit_at(buf, len, "\n");
+}
+
+// ---
+
+// Atributos comuns a todos os grupos: /sys/kernel/config/smartlamp/<grupo>/{period_ms, max_age_ms}
+
+static ssize_t item_period_ms_show(struct config_item *item, char *buf) {
+    return sprintf(buf, "%u\n", READ_ONCE(to_smartlamp_item(item)->period_ms));
+}
+
+// Novo período: o amostrador é reagendado para ter efeito imediato (0 desliga)
+static ssize_t item_period_ms_store(struct config_item *item, const char *buf, size_t count) {
+    struct smartlamp_item *it = to_smartlamp_item(item);
+    unsigned int period;
+
+    if (kstrtouint(buf, 0, &period))
+        return -EINVAL;
+
+    WRITE_ONCE(it->period_ms, period);
+    if (period)
+        mod_delayed_work(system_wq, &it->sampler_work, 0);
+    return count;
+}
+CONFIGFS_ATTR(item_, period_ms);
+
+static ssize_t item_max_age_ms_show(struct config_item *item, char *buf) {
+    return sprintf(buf, "%u\n", READ_ONCE(to_smartlamp_item(item)->max_age_ms));
+}
+
+static ssize_t item_max_age_ms_store(struct config_item *item, const char *buf, size_t count) {
+    unsigned int max_age;
+
+    if (kstrtouint(buf, 0, &max_age))
+        return -EINVAL;
+
+    WRITE_ONCE(to_smartlamp_item(item)->max_age_ms, max_age);
+    return count;
+}
+CONFIGFS_ATTR(item_, max_age_ms);
+
+// Libera o grupo quando a última referência é solta (depois do rmdir)
+static void item_release(struct config_item *item) {
+    kfree(to_smartlamp_item(item));
+}
+
+static struct configfs_item_operations item_ops = {
+    .release = item_release,
 };
 
+// ---
+
+// LED
 static ssize_t led_value_show(struct config_item *item, char *buf) {
-    // Read LED state is not implemented by the firmware, return dummy
-    return sprintf(buf, "0\n");
+    return item_show(item, 0, buf);
 }
 
 static ssize_t led_value_store(struct config_item *item, const char *buf, size_t count) {
-    if (buf[0] == '0' || buf[0] == '1') {
-        char cmd[16];
-        snprintf(cmd, sizeof(cmd), "SET_LED %c", buf[0]);
-        smartlamp_send_command(cmd, NULL, 0);
-
-        // Controlar o LED do teclado ScrollLock
-        if (buf[0] == '1')
-            printk(KERN_INFO "\033[1 q");
-        else
-            printk(KERN_INFO "\033[0 q");
-
-        return count;
-    }
-    return -EINVAL;
+    struct smartlamp_item *it = to_smartlamp_item(item);
+    struct smartlamp *dev;
+    long value;
+    int ret;
+
+    if (kstrtol(buf, 10, &value))
+        return -EINVAL;
+
+    dev = smartlamp_get(lamp);
+    if (!dev)
+        return -ENODEV;
+    ret = smartlamp_write(dev, SENSOR_LED, value);
+    smartlamp_put(dev);
+    if (ret)
+        return ret;
+
+    // O valor confirmado pela lâmpada passa a ser o do cache
+    write_seqlock(&it->cache_lock);
+    it->value[0] = value;
+    it->valid |= BIT(0);
+    write_sequnlock(&it->cache_lock);
+    return count;
 }
 CONFIGFS_ATTR(led_, value);
 
 static struct configfs_attribute *led_attrs[] = {
     &led_attr_value,
+    &item_attr_period_ms,
+    &item_attr_max_age_ms,
     NULL,
 };
 
-static struct configfs_item_operations led_item_ops = {};
-
-static struct config_item_type led_type = {
-    .ct_item_ops = &led_item_ops,
+static const struct config_item_type led_type = {
+    .ct_item_ops = &item_ops,
     .ct_attrs = led_attrs,
     .ct_owner = THIS_MODULE,
 };
 
 // LDR
 static ssize_t ldr_value_show(struct config_item *item, char *buf) {
-    char response[64] = {0};
-    smartlamp_send_command("GET_LDR", response, sizeof(response));
-    return sprintf(buf, "%s\n", response);
+    return item_show(item, 0, buf);
 }
 CONFIGFS_ATTR_RO(ldr_, value);
 
 static struct configfs_attribute *ldr_attrs[] = {
     &ldr_attr_value,
+    &item_attr_period_ms,
+    &item_attr_max_age_ms,
     NULL,
 };
 
-static struct configfs_item_operations ldr_item_ops = {};
-
-static struct config_item_type ldr_type = {
-    .ct_item_ops = &ldr_item_ops,
+static const struct config_item_type ldr_type = {
+    .ct_item_ops = &item_ops,
     .ct_attrs = ldr_attrs,
     .ct_owner = THIS_MODULE,
 };
 
 // DHT
 static ssize_t dht_temperature_show(struct config_item *item, char *buf) {
-    char response[64] = {0};
-    smartlamp_send_command("GET_TEMP", response, sizeof(response));
-    return sprintf(buf, "%s\n", response);
+    return item_show(item, 0, buf);
 }
 CONFIGFS_ATTR_RO(dht_, temperature);
 
 static ssize_t dht_humidity_show(struct config_item *item, char *buf) {
-    char response[64] = {0};
-    smartlamp_send_command("GET_HUM", response, sizeof(response));
-    return sprintf(buf, "%s\n", response);
+    return item_show(item, 1, buf);
 }
 CONFIGFS_ATTR_RO(dht_, humidity);
 
 static struct configfs_attribute *dht_attrs[] = {
     &dht_attr_temperature,
     &dht_attr_humidity,
+    &item_attr_period_ms,
+    &item_attr_max_age_ms,
     NULL,
 };
 
-static struct configfs_item_operations dht_item_ops = {};
-
-static struct config_item_type dht_type = {
-    .ct_item_ops = &dht_item_ops,
+static const struct config_item_type dht_type = {
+    .ct_item_ops = &item_ops,
     .ct_attrs = dht_attrs,
     .ct_owner = THIS_MODULE,
 };
 
-// Raiz
+// Grupos aceitos no mkdir. O LED só muda por escrita (ou pelo controle automático), então é lido na hora;
+// o LDR é amostrado com frequência e o DHT, que leva cerca de 2 s por leitura, raramente.
+static const struct smartlamp_group_desc group_table[] = {
+    { .name = "led", .type = &led_type, .sensors = { SENSOR_LED }, .nsensors = 1,
+      .period_ms = 0, .max_age_ms = 0 },
+    { .name = "ldr", .type = &ldr_type, .sensors = { SENSOR_LDR }, .nsensors = 1,
+      .period_ms = 100, .max_age_ms = 250 },
+    { .name = "dht", .type = &dht_type, .sensors = { SENSOR_TEMP, SENSOR_HUM }, .nsensors = 2,
+      .period_ms = 5000, .max_age_ms = 10000 },
+};
+
+// ---
+
+// Raiz: mkdir /sys/kernel/config/smartlamp/{led, ldr, dht}
 static struct config_group *smartlamp_make_group(struct config_group *group, const char *name) {
-    struct smartlamp_item *item;
-
-    item = kzalloc(sizeof(*item), GFP_KERNEL);
-    if (!item)
-        return NULL;
-
-    if (strcmp(name, "led") == 0)
-        config_item_init_type_name(&item->item.cg_item, name, &led_type);
-    else if (strcmp(name, "ldr") == 0)
-        config_item_init_type_name(&item->item.cg_item, name, &ldr_type);
-    else if (strcmp(name, "dht") == 0)
-        config_item_init_type_name(&item->item.cg_item, name, &dht_type);
-    else {
-        kfree(item);
-        return NULL;
-    }
+    const struct smartlamp_group_desc *desc = NULL;
+    struct smartlamp_item *it;
+    int i;
 
-    return &item->item;
+    for (i = 0; i < ARRAY_SIZE(group_table); i++)
+        if (strcmp(name, group_table[i].name) == 0)
+            desc = &group_table[i];
+    if (!desc)
+        return ERR_PTR(-EINVAL);
+
+    it = kzalloc(sizeof(*it), GFP_KERNEL);
+    if (!it)
+        return ERR_PTR(-ENOMEM);
+
+    it->desc = desc;
+    it->period_ms = desc->period_ms;
+    it->max_age_ms = desc->max_age_ms;
+    seqlock_init(&it->cache_lock);
+    mutex_init(&it->refresh_mutex);
+    INIT_DELAYED_WORK(&it->sampler_work, item_sampler_fn);
+    config_group_init_type_name(&it->group, name, desc->type);
+
+    WRITE_ONCE(it->running, true);
+    if (it->period_ms)
+        schedule_delayed_work(&it->sampler_work, 0);
+
+    return &it->group;
 }
 
+// rmdir: para o amostrador antes de soltar a referência (a estrutura é liberada em item_release)
 static void smartlamp_drop_item(struct config_group *group, struct config_item *item) {
-    kfree(container_of(to_config_group(item), struct smartlamp_item, item));
+    struct smartlamp_item *it = to_smartlamp_item(item);
+
+    WRITE_ONCE(it->running, false);
+    cancel_delayed_work_sync(&it->sampler_work);
+    config_item_put(item);
 }
 
 static struct configfs_group_operations smartlamp_group_ops = {
@@ -164,7 +368,7 @@ static struct configfs_group_operations smartlamp_group_ops = {
     .drop_item = smartlamp_drop_item,
 };
 
-static struct config_item_type smartlamp_type = {
+static const struct config_item_type smartlamp_type = {
     .ct_group_ops = &smartlamp_group_ops,
     .ct_owner = THIS_MODULE,
 };
@@ -178,59 +382,18 @@ static struct configfs_subsystem smartlamp_subsys = {
     },
 };
 
-// USB probe/disconnect
-static int smartlamp_probe(struct usb_interface *interface, const struct usb_device_id *id) {
-    struct usb_host_interface *iface_desc;
-    struct usb_endpoint_descriptor *endpoint;
-    int i;
-
-    smartlamp_device = interface_to_usbdev(interface);
-    iface_desc = interface->cur_altsetting;
-
-    for (i = 0; i < iface_desc->desc.bNumEndpoints; ++i) {
-        endpoint = &iface_desc->endpoint[i].desc;
-        if (usb_endpoint_is_bulk_in(endpoint)) {
-            usb_in = endpoint->bEndpointAddress;
-            usb_max_size = usb_endpoint_maxp(endpoint);
-        } else if (usb_endpoint_is_bulk_out(endpoint)) {
-            usb_out = endpoint->bEndpointAddress;
-        }
-    }
-
-    usb_in_buffer = kmalloc(usb_max_size, GFP_KERNEL);
-    usb_out_buffer = kmalloc(usb_max_size, GFP_KERNEL);
-
-    return 0;
-}
-
-static void smartlamp_disconnect(struct usb_interface *interface) {
-    kfree(usb_in_buffer);
-    kfree(usb_out_buffer);
-    smartlamp_device = NULL;
-}
-
-static struct usb_device_id smartlamp_table[] = {
-    { USB_DEVICE(VENDOR_ID, PRODUCT_ID) },
-    {}
-};
-MODULE_DEVICE_TABLE(usb, smartlamp_table);
-
-static struct usb_driver smartlamp_driver = {
-    .name = "smartlamp",
-    .id_table = smartlamp_table,
-    .probe = smartlamp_probe,
-    .disconnect = smartlamp_disconnect,
-};
-
 static int __init smartlamp_init(void) {
     int ret;
-    configfs_register_subsystem(&smartlamp_subsys);
-    ret = usb_register(&smartlamp_driver);
+
+    config_group_init(&smartlamp_subsys.su_group);
+    mutex_init(&smartlamp_subsys.su_mutex);
+    ret = configfs_register_subsystem(&smartlamp_subsys);
+    if (ret)
+        printk(KERN_ERR "SmartLamp: falha ao registrar o configfs. Codigo: %d\n", ret);
     return ret;
 }
 
 static void __exit smartlamp_exit(void) {
-    usb_deregister(&smartlamp_driver);
     configfs_unregister_subsystem(&smartlamp_subsys);
 }
 
@@ -5,51 +5,641 @@
 #include <linux/string.h>
 #include <linux/fs.h>
 #include <linux/uaccess.h> // Incluída para o sscanf
+#include <linux/completion.h>
+#include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/seqlock.h>
+#include <linux/workqueue.h>
+#include <linux/jiffies.h>
+#include <linux/moduleparam.h>
+#include <linux/crc-ccitt.h>
+#include <linux/build_bug.h>
+#include <linux/idr.h>
+#include <linux/list.h>
+#include <linux/kobject.h>
+#include <linux/sysfs.h>
+#include <linux/wait.h>
+#include <linux/miscdevice.h>
+#include <linux/kfifo.h>
+#include <linux/poll.h>
+#include <linux/ktime.h>
+#include <linux/vmalloc.h>
+#include <linux/mm.h>
+#include <linux/delay.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/log2.h>
+#include <linux/irq_work.h>
+#include <linux/leds.h>
+#include <linux/iio/iio.h>
+#include <linux/iio/buffer.h>
+#include <linux/iio/trigger.h>
+#include <linux/iio/trigger_consumer.h>
+#include <linux/iio/triggered_buffer.h>
+
+#include "smartlamp_uapi.h"
+#include "smartlamp.h"
+
+#define CREATE_TRACE_POINTS
+#include "smartlamp_trace.h"
 
 MODULE_AUTHOR("DevTITANS <devtitans@icomp.ufam.edu.br>");
 MODULE_DESCRIPTION("Driver de acesso ao SmartLamp (ESP32 com Chip Serial CP2102");
 MODULE_LICENSE("GPL");
 
 #define MAX_RECV_LINE 100 // Tamanho máximo de uma linha de resposta do dispositivo USB
+#define NUM_IN_URBS   4   // Quantidade de URBs de leitura mantidas sempre pendentes no endpoint de entrada
+#define RESP_TIMEOUT  2000 // Tempo máximo (ms) de espera pela resposta de um comando
+#define MAX_INFLIGHT  16  // Máximo de comandos com tag em andamento ao mesmo tempo em uma lâmpada
+#define SAMPLE_FIFO_LEN 256 // Amostras guardadas para cada leitor de /dev/smartlampN (potência de 2)
+#define LOG_REPLAY_LEN  SAMPLE_FIFO_LEN // Registros recuperados entregues a quem abre /dev/smartlampN depois (os mais recentes)
+#define DEFAULT_BAUD  9600 // Velocidade da serial com que o firmware inicia
+#define BAUD_CONFIRM_MS 1000 // Sem um comando válido nesse tempo após trocar de velocidade, o firmware volta para DEFAULT_BAUD
+#define LDR_WINDOW_DEFAULT 50 // Janela de estatísticas do LDR com que o firmware inicia (amostras)
+#define RING_ENTRIES  1024 // Entradas do anel mapeável de /dev/smartlampN (potência de 2)
+#define RING_SIZE     (PAGE_SIZE + PAGE_ALIGN(RING_ENTRIES * sizeof(struct smartlamp_sample))) // Cabeçalho + entradas
+#define LED_RAMP_MAX_MS 60000 // Duração máxima de uma transição SET_LED_RAMP (a mesma do firmware)
+#define LAT_HIST_BUCKETS 24 // Faixas do histograma de latência no debugfs (potências de 2 em µs, até ~8 s)
+#define CLOCK_RTT_SLACK_NS (200 * NSEC_PER_USEC) // Folga sobre 1,5x a menor ida e volta para um par corrigir o relógio
+#define CLOCK_DRIFT_MIN_NS (10LL * NSEC_PER_SEC)   // Base mínima (no relógio do ESP32) para estimar a deriva
+#define CLOCK_DRIFT_MAX_NS (3600LL * NSEC_PER_SEC) // Base máxima: a partir daí a base recomeça na referência atual
+#define CLOCK_RESYNC_NS   (100 * NSEC_PER_MSEC) // Desvio maior indica que o ESP32 reiniciou: recomeça a correlação
+
+// Última leitura de todos os sensores, protegida por snapshot_lock
+struct smartlamp_snapshot {
+    long          value[SENSOR_COUNT];            // Valores lidos
+    unsigned long valid;                          // Bit i ligado se value[i] foi lido com sucesso
+    unsigned long stamp;                          // jiffies da última atualização
+    u64           time_ns[SENSOR_COUNT];          // Instante de cada amostra (CLOCK_MONOTONIC)
+};
+
+// Resposta de GET_ALL_TS: os sensores e o relógio do ESP32 (micros(), 32 bits) na resposta e em cada amostra,
+// mais o envio e a chegada no host, que formam o par usado para correlacionar os dois relógios
+struct smartlamp_stamped {
+    struct smartlamp_snapshot all;
+    u32                       now_us;             // micros() da resposta
+    u32                       ldr_us;             // micros() do meio da última janela do LDR
+    u32                       dht_us;             // micros() da última leitura do DHT
+    u64                       sent_ns, recv_ns;   // Envio do comando e chegada da resposta (ktime_get_ns)
+};
+
+// Correlação entre o relógio do ESP32 e o CLOCK_MONOTONIC do host, protegida por clock_lock.
+// Cada par envio/resposta de GET_ALL_TS dá um ponto: o instante da resposta no ESP32 corresponde ao meio da
+// ida e volta. Só pares com ida e volta perto da menor já vista corrigem a referência (nos outros a resposta
+// esperou em alguma fila); a deriva é a inclinação entre a primeira referência e a atual.
+struct smartlamp_clock {
+    u64 dev_us;                                   // Último instante do ESP32, estendido para 64 bits (micros() volta a zero a cada ~71 min)
+    u64 ref_dev_us, ref_host_ns;                  // Referência: instante do ESP32 e o instante correspondente no host
+    u64 anchor_dev_us, anchor_host_ns;            // Início da base usada para a deriva
+    s64 drift_ppb;                                // Quanto o relógio do ESP32 atrasa em relação ao host (partes por bilhão)
+    s64 residual_ns;                              // Meio do último par menos o instante previsto para a resposta
+    u64 rtt_ns, rtt_min_ns, rtt_avg_ns;           // Ida e volta do último par, a menor e a média móvel
+    u64 jitter_ns;                                // Média móvel de |residual_ns|
+    u64 samples;                                  // Pares recebidos desde a última (re)sincronização
+    u64 last_recv_ns;                             // Chegada do último par (leituras agrupadas recebem o mesmo par)
+};
+
+// Formato do valor de um sensor ou da resposta de um comando
+enum smartlamp_fmt {
+    FMT_INT,        // Inteiro (e.g., "42")
+    FMT_CENTI,      // Duas casas decimais, guardado em centésimos (e.g., "25.30" -> 2530)
+    FMT_ACK,        // Inteiro que precisa ser 1 (e.g., "RES SET_LED 1")
+    FMT_ALL,        // Todos os sensores (GET_ALL), em struct smartlamp_snapshot
+    FMT_LDR_STATS,  // Estatísticas do LDR (GET_LDR_STATS), em long[LDR_STAT_COUNT]
+    FMT_AUTO,       // Estado do controle automático (GET_AUTO), em long[AUTO_FIELD_COUNT]
+    FMT_ALL_TS,     // Todos os sensores com os instantes das amostras (GET_ALL_TS), em struct smartlamp_stamped
+    FMT_DUMP,       // Fim de um DUMP, em long[DUMP_FIELD_COUNT]
+};
+
+// Estatísticas da última janela de amostras do LDR calculadas pelo firmware (GET_LDR_STATS), em centésimos
+enum smartlamp_ldr_stat {
+    LDR_STAT_MEAN,
+    LDR_STAT_MIN,
+    LDR_STAT_MAX,
+    LDR_STAT_VAR,   // Variância (escala de 0 a 100, ao quadrado)
+    LDR_STAT_COUNT
+};
+
+// Campos da resposta de GET_AUTO: configuração e estado do controle automático de luminosidade do firmware
+enum smartlamp_auto_field {
+    AUTO_ENABLED,
+    AUTO_SETPOINT,  // Média do LDR desejada (0 a 100)
+    AUTO_KP,        // Ganhos em milésimos
+    AUTO_KI,
+    AUTO_HYST,      // Histerese (escala do LDR)
+    AUTO_MIN,       // Limites do LED
+    AUTO_MAX,
+    AUTO_LDR,       // Média atual do LDR, em centésimos
+    AUTO_LED,       // Saída atual do controlador, em centésimos
+    AUTO_SETTLED,   // Erro dentro da histerese (saída parada)
+    AUTO_FIELD_COUNT
+};
+// Campos da resposta de DUMP (os registros chegam antes, em quadros BIN_OP_LOG_RECORD)
+enum smartlamp_dump_field {
+    DUMP_SENT,      // Registros enviados (-1: DUMP recusado)
+    DUMP_NEXT,      // Número do registro seguinte ao último enviado
+    DUMP_BOOT,      // Identificador do boot do firmware (muda quando o ESP32 reinicia)
+    DUMP_FIELD_COUNT
+};
+
+#define AUTO_CONFIG_COUNT (AUTO_MAX - AUTO_SETPOINT + 1)   // Argumentos de SET_AUTO (de AUTO_SETPOINT a AUTO_MAX)
+#define AUTO_GAIN_MAX     1000000                          // Mesmo limite do firmware (1000.000)
+
+// Comandos do protocolo, descritos em cmd_table
+enum smartlamp_cmd {
+    CMD_SET_LED,
+    CMD_GET_LED,
+    CMD_GET_LDR,
+    CMD_GET_TEMP,
+    CMD_GET_HUM,
+    CMD_GET_ALL,
+    CMD_GET_LDR_STATS,
+    CMD_SET_LDR_WINDOW,
+    CMD_STREAM,
+    CMD_BAUD,
+    CMD_STOP,
+    CMD_PROTO_BIN,
+    CMD_SET_LED_RAMP,
+    CMD_AUTO,
+    CMD_SET_AUTO,
+    CMD_GET_AUTO,
+    CMD_GET_ALL_TS,
+    CMD_DUMP,
+    CMD_COUNT
+};
+
+// Contadores de um comando, protegidos por stats_lock.
+// hist[0] conta respostas em menos de 1 µs e hist[i] as entre 2^(i-1) e 2^i µs (a última faixa acumula o resto).
+struct smartlamp_cmd_stats {
+    u64 count;                                    // Comandos concluídos (com ou sem erro)
+    u64 errors;                                   // Comandos que falharam (inclui timeouts)
+    u64 timeouts;                                 // Sem posição na janela ou sem resposta a tempo
+    u64 bytes_out, bytes_in;                      // Bytes do comando enviado e da resposta recebida
+    u64 total_ns, max_ns;                         // Duração acumulada e máxima
+    u64 hist[LAT_HIST_BUCKETS];                   // Histograma log2 da duração
+    u64 coalesced;                                // Chamadas atendidas por uma leitura idêntica já em andamento
+};
+
+// Resultado de um envio, usado para contabilizar o comando depois que ele termina
+struct smartlamp_xfer {
+    u8  tag;                                      // Tag usada no envio
+    int bytes_out, bytes_in;
+    bool timeout;
+};
+
+// Leitura em andamento compartilhada por chamadas idênticas (single-flight). Alocada por quem envia o
+// comando; quem pede a mesma leitura enquanto ela está na lâmpada só espera done e copia o resultado.
+struct smartlamp_flight {
+    struct completion done;                       // Resposta convertida (ou erro)
+    int               users;                      // Quem envia e quem espera, protegido por flight_mutex
+    int               ret;                        // Retorno do envio
+    union {                                       // Resultado no formato do comando
+        long                      value;
+        struct smartlamp_snapshot all;
+        struct smartlamp_stamped  stamped;
+        long                      ldr_stats[LDR_STAT_COUNT];
+        long                      auto_fields[AUTO_FIELD_COUNT];
+    } result;
+};
+
+// Bridge USB-serial CP210x (AN571): requisições de controle do fabricante para configurar a UART
+#define CP210X_REQTYPE_HOST_TO_DEVICE 0x41
+#define CP210X_IFC_ENABLE     0x00
+#define CP210X_SET_LINE_CTL   0x03
+#define CP210X_SET_BAUDRATE   0x1E
+#define CP210X_UART_ENABLE    0x0001
+#define CP210X_LINE_8N1       0x0800   // 8 bits de dados, sem paridade, 1 bit de parada
+
+// Protocolo binário (negociado no probe com "PROTO BIN"; o texto continua como alternativa).
+// Quadros de tamanho fixo, little-endian, com valores em ponto fixo (temperatura e umidade em centésimos):
+//   sync(0xA5) | len | op | seq | value[4] (s32) | crc16
+// len é a quantidade de bytes úteis em value; o CRC-16/CCITT (0x8408, init 0xFFFF) cobre de len até value.
+// Deve ser mantido igual ao smartlamp.ino.
+#define BIN_SYNC        0xA5
+#define BIN_MAX_VALUES  4
+#define BIN_OP_RESP     0x80         // Bit ligado no opcode das respostas
+#define BIN_OP_ERR      0xFF         // Resposta de erro (comando desconhecido ou inválido)
+#define BIN_INVALID     S32_MIN      // Valor de sensor que não pôde ser lido (e.g., DHT sem resposta)
+
+enum smartlamp_bin_op {
+    BIN_OP_NONE     = 0x00,
+    BIN_OP_GET_LED  = 0x01,
+    BIN_OP_SET_LED  = 0x02,
+    BIN_OP_GET_LDR  = 0x03,
+    BIN_OP_GET_TEMP = 0x04,
+    BIN_OP_GET_HUM  = 0x05,
+    BIN_OP_GET_ALL  = 0x06,
+    BIN_OP_GET_LDR_STATS = 0x07,
+    BIN_OP_SET_LED_RAMP  = 0x08,
+    BIN_OP_LOG_RECORD    = 0x40,     // Registro enviado pelo firmware durante um DUMP (não responde a um quadro)
+};
+
+struct smartlamp_frame {
+    u8     sync;
+    u8     len;
+    u8     op;
+    u8     seq;
+    __le32 value[BIN_MAX_VALUES];
+    __le16 crc;
+} __packed;
+
+#define BIN_FRAME_SIZE  sizeof(struct smartlamp_frame)
+#define BIN_CRC_LEN     (offsetof(struct smartlamp_frame, crc) - offsetof(struct smartlamp_frame, len))
+static_assert(BIN_FRAME_SIZE == 22);
+static_assert(SENSOR_COUNT <= BIN_MAX_VALUES);   // GET_ALL responde todos os sensores num único quadro
+
+// Descritor de um comando: texto enviado, prefixo da resposta, argumentos, opcode binário e formato do valor,
+// tudo fixo em tempo de compilação. O envio só formata os argumentos.
+struct smartlamp_cmd_desc {
+    const char        *wire;                      // Comando em texto, sem argumentos (e.g., "GET_LED")
+    u8                 wire_len;
+    const char        *resp;                      // Prefixo da resposta (e.g., "RES GET_LED")
+    u8                 resp_len;
+    u8                 nargs;                     // Argumentos inteiros enviados após o comando
+    bool               sensor_arg;                // O primeiro argumento é um sensor, enviado pelo nome (e.g., "STREAM LDR 100")
+    u8                 bin_op;                    // Opcode no protocolo binário (BIN_OP_NONE: sempre em texto)
+    enum smartlamp_fmt fmt;                       // Formato do valor da resposta
+};
+
+#define CMD_DESC(_id, _wire, _nargs, _op, _fmt, ...)                                        \
+    [_id] = { .wire = _wire, .wire_len = sizeof(_wire) - 1,                                 \
+              .resp = "RES " _wire, .resp_len = sizeof("RES " _wire) - 1,                   \
+              .nargs = _nargs, .bin_op = _op, .fmt = _fmt, __VA_ARGS__ }
+
+static const struct smartlamp_cmd_desc cmd_table[CMD_COUNT] = {
+    CMD_DESC(CMD_SET_LED,        "SET_LED",        1, BIN_OP_SET_LED,       FMT_ACK),
+    CMD_DESC(CMD_GET_LED,        "GET_LED",        0, BIN_OP_GET_LED,       FMT_INT),
+    CMD_DESC(CMD_GET_LDR,        "GET_LDR",        0, BIN_OP_GET_LDR,       FMT_INT),
+    CMD_DESC(CMD_GET_TEMP,       "GET_TEMP",       0, BIN_OP_GET_TEMP,      FMT_CENTI),
+    CMD_DESC(CMD_GET_HUM,        "GET_HUM",        0, BIN_OP_GET_HUM,       FMT_CENTI),
+    CMD_DESC(CMD_GET_ALL,        "GET_ALL",        0, BIN_OP_GET_ALL,       FMT_ALL),
+    CMD_DESC(CMD_GET_LDR_STATS,  "GET_LDR_STATS",  0, BIN_OP_GET_LDR_STATS, FMT_LDR_STATS),
+    CMD_DESC(CMD_SET_LDR_WINDOW, "SET_LDR_WINDOW", 1, BIN_OP_NONE,          FMT_ACK),
+    CMD_DESC(CMD_STREAM,         "STREAM",         2, BIN_OP_NONE,          FMT_ACK, .sensor_arg = true), // Sensor e Hz
+    CMD_DESC(CMD_BAUD,           "BAUD",           1, BIN_OP_NONE,          FMT_ACK),
+    CMD_DESC(CMD_STOP,           "STOP",           0, BIN_OP_NONE,          FMT_ACK),
+    CMD_DESC(CMD_PROTO_BIN,      "PROTO BIN",      0, BIN_OP_NONE,          FMT_ACK),
+    CMD_DESC(CMD_SET_LED_RAMP,   "SET_LED_RAMP",   3, BIN_OP_SET_LED_RAMP,  FMT_ACK),  // Destino, ms e curva
+    CMD_DESC(CMD_AUTO,           "AUTO",           1, BIN_OP_NONE,          FMT_ACK),
+    CMD_DESC(CMD_SET_AUTO,       "SET_AUTO",       AUTO_CONFIG_COUNT, BIN_OP_NONE, FMT_ACK),
+    CMD_DESC(CMD_GET_AUTO,       "GET_AUTO",       0, BIN_OP_NONE,          FMT_AUTO),
+    CMD_DESC(CMD_GET_ALL_TS,     "GET_ALL_TS",     0, BIN_OP_NONE,          FMT_ALL_TS),  // Não cabe num quadro binário
+    CMD_DESC(CMD_DUMP,           "DUMP",           3, BIN_OP_NONE,          FMT_DUMP),    // Desde, máximo e idade máxima (ms)
+};
+
+// Descritor de um sensor: nomes, comandos de leitura e escrita, formato e faixa aceita na escrita.
+// Os arquivos /sys/kernel/smartlamp/lampN/<nome> são criados a partir desta tabela, então um sensor novo
+// precisa apenas da sua entrada aqui (e do comando em cmd_table) além do suporte no firmware.
+struct smartlamp_sensor_desc {
+    const char        *name;                      // Arquivo no sysfs e nome aceito em stream (e.g., "temp")
+    const char        *wire;                      // Nome no protocolo, em STREAM e STR (e.g., "TEMP")
+    enum smartlamp_cmd get;                       // Comando de leitura
+    int                set;                       // Comando de escrita (-1 se somente leitura)
+    enum smartlamp_fmt fmt;                       // FMT_INT ou FMT_CENTI
+    long               min, max;                  // Faixa aceita na escrita
+    size_t             sample_offset;             // Campo (s32) em struct smartlamp_sample
+};
+
+static const struct smartlamp_sensor_desc sensor_table[SENSOR_COUNT] = {
+    [SENSOR_LED]  = { .name = "led",  .wire = "LED",  .get = CMD_GET_LED,  .set = CMD_SET_LED, .fmt = FMT_INT,
+                      .min = 0, .max = 100, .sample_offset = offsetof(struct smartlamp_sample, led) },
+    [SENSOR_LDR]  = { .name = "ldr",  .wire = "LDR",  .get = CMD_GET_LDR,  .set = -1, .fmt = FMT_INT,
+                      .sample_offset = offsetof(struct smartlamp_sample, ldr) },
+    [SENSOR_TEMP] = { .name = "temp", .wire = "TEMP", .get = CMD_GET_TEMP, .set = -1, .fmt = FMT_CENTI,
+                      .sample_offset = offsetof(struct smartlamp_sample, temp) },
+    [SENSOR_HUM]  = { .name = "hum",  .wire = "HUM",  .get = CMD_GET_HUM,  .set = -1, .fmt = FMT_CENTI,
+                      .sample_offset = offsetof(struct smartlamp_sample, hum) },
+};
+
+// Comando aguardando resposta: preenchido pelo callback de leitura quando chega a linha (ou quadro) esperada.
+// A tag é enviada junto com o comando ("#<tag> GET_LDR" ou campo seq do quadro) e devolvida pelo firmware,
+// o que permite vários comandos em andamento e roteia cada resposta para quem a espera.
+struct smartlamp_waiter {
+    const char        *resp_expected;             // Prefixo da resposta esperada (e.g., "RES GET_LDR")
+    size_t             resp_len;                  // Tamanho do prefixo
+    char               line[MAX_RECV_LINE];       // Cópia da linha recebida
+    bool               binary;                    // Comando enviado como quadro binário
+    u8                 bin_op;                    // Opcode enviado (modo binário)
+    u8                 tag;                       // Tag do comando (também o seq no modo binário)
+    int                slot;                      // Posição em inflight[] (-1 se fora da janela)
+    int                status;                    // Erro entregue sem resposta (e.g., -ENODEV na desconexão)
+    u64                sent_ns;                   // Instante do envio (para a latência no tracepoint)
+    u64                recv_ns;                   // Chegada da resposta, registrada pelo callback das URBs
+    struct smartlamp_frame frame;                 // Cópia do quadro recebido (modo binário)
+    struct completion  done;                      // Sinalizada quando a resposta esperada chega
+};
+
+// Estado de uma SmartLamp conectada. Cada lâmpada tem seus próprios buffers, locks e amostrador,
+// então comandos para lâmpadas diferentes executam em paralelo.
+// O tempo de vida da estrutura é controlado pelo kobject de /sys/kernel/smartlamp/lampN.
+struct smartlamp {
+    struct kobject          kobj;                 // Diretório /sys/kernel/smartlamp/lampN
+    int                     index;                // N em lampN
+    struct list_head        node;                 // Entrada em smartlamp_list
+    struct usb_device      *udev;                 // Referência para o dispositivo USB
+    struct usb_interface   *interface;            // Interface USB associada
+    uint                    usb_in, usb_out;      // Endereços das portas de entrada e saida da USB
+    int                     usb_max_size;         // Tamanho máximo de uma mensagem USB
+    char                   *out_buf[MAX_INFLIGHT]; // Buffers (DMA) para montar o comando de cada posição da janela
+    bool                    disconnected;         // Dispositivo removido: novos comandos falham com -ENODEV
+
+    // Recepção assíncrona
+    struct urb             *in_urbs[NUM_IN_URBS]; // URBs de leitura sempre submetidas entre o probe e o disconnect
+    struct usb_anchor       in_anchor;            // Âncora das URBs de leitura (permite cancelar todas de uma vez)
+    spinlock_t              recv_lock;            // Protege o montador de linhas/quadros e a janela de comandos
+    char                    recv_line[MAX_RECV_LINE]; // Armazena dados vindos da USB até receber um caractere de nova linha '\n'
+    int                     recv_size;            // Quantidade de caracteres já acumulados em recv_line
+    u8                      recv_frame[BIN_FRAME_SIZE]; // Armazena um quadro binário em montagem
+    int                     frame_size;           // Quantidade de bytes já acumulados em recv_frame
+    unsigned long           crc_errors;           // Quadros descartados por CRC inválido
+    u64                     rx_bytes, rx_chunks;  // Bytes e blocos recebidos pelas URBs de leitura
+    u64                     rx_last_ns;           // Chegada do último bloco
+
+    // Janela de comandos em andamento
+    struct smartlamp_waiter *inflight[MAX_INFLIGHT]; // Comandos aguardando resposta, indexados pela posição
+    int                     inflight_count;       // Posições ocupadas em inflight[]
+    int                     window;               // Máximo de comandos em andamento (1 sem tags)
+    wait_queue_head_t       inflight_wq;          // Espera por uma posição livre na janela
+    u8                      next_tag;             // Próxima tag a ser usada
+    bool                    tagged;               // Firmware devolve a tag nas respostas
+    bool                    use_binary;           // Protocolo binário negociado com o firmware
+    bool                    has_get_all;          // Firmware aceita GET_ALL (todos os sensores numa resposta)
+    bool                    has_get_all_ts;       // Firmware informa os instantes das amostras (GET_ALL_TS)
+    struct smartlamp_flight *flights[CMD_COUNT];  // Leitura em andamento de cada comando (NULL nenhuma)
+    struct mutex            flight_mutex;         // Protege flights e o users de cada leitura
+
+    // Snapshot dos sensores
+    struct smartlamp_snapshot snapshot;           // Última leitura dos sensores, servida pelo attr_show
+    seqlock_t               snapshot_lock;        // Leitores do snapshot nunca bloqueiam o amostrador
+    struct mutex            refresh_mutex;        // Evita atualizações simultâneas do snapshot
+    struct delayed_work     sampler_work;         // Atualiza o snapshot periodicamente
+    bool                    sampler_running;      // Amostrador em segundo plano ativo
+
+    // Dispositivo /dev/smartlampN
+    struct miscdevice       misc;                 // Dispositivo de caractere com o fluxo de amostras
+    char                    misc_name[16];        // "smartlampN"
+    struct list_head        readers;              // Arquivos abertos (smartlamp_reader)
+    spinlock_t              readers_lock;         // Protege readers, sample_seq e o anel (amostras chegam também do callback USB)
+    wait_queue_head_t       read_wq;              // Leitores esperando novas amostras
+    u32                     sample_seq;           // Número da próxima amostra
+    void                   *ring;                 // Anel mapeável (vmalloc_user): cabeçalho + RING_ENTRIES amostras
+
+    // Modo STREAM: o firmware envia amostras de um sensor sem ser consultado ("STR <sensor> <valor>")
+    int                     stream_sensor;        // Sensor transmitido (-1 desligado)
+    unsigned int            stream_rate;          // Frequência pedida (Hz)
+
+    unsigned int            ldr_window;           // Amostras por janela de estatísticas do LDR no firmware
+    unsigned int            baud;                 // Velocidade atual da serial entre a bridge e o ESP32
+
+    // LED class (/sys/class/leds/smartlampN::): o brilho pedido é enviado por um worker, só o mais recente
+    struct led_classdev     led_cdev;
+    char                    led_name[24];         // "smartlampN::"
+    struct work_struct      led_work;             // Envia led_pending
+    int                     led_pending;          // Último brilho pedido e ainda não enviado (-1 nenhum)
+    bool                    led_live;             // Pedidos do LED class chegam à lâmpada (falso durante a remoção)
+    struct mutex            led_mutex;            // Ordena os envios de SET_LED (worker e escritas síncronas)
+
+    // Dispositivo IIO (/sys/bus/iio/devices/iio:deviceN e /dev/iio:deviceN)
+    struct iio_dev         *indio;                // Canais de luz, temperatura e umidade
+    struct iio_trigger     *iio_trig;             // Gatilho "smartlamp-lampN", disparado a cada amostra publicada
+    struct irq_work         iio_work;             // Dispara o gatilho fora do readers_lock
+    struct smartlamp_sample iio_latest;           // Último valor de cada sensor (amostras STREAM trazem só um), protegido por readers_lock
+    bool                    iio_live;             // Amostras publicadas disparam o gatilho (falso durante a remoção)
+
+    // Registro de amostras do firmware, recuperado com DUMP depois do probe
+    struct work_struct      backfill_work;        // Recupera os registros sem atrasar o probe
+    u32                     log_boot;             // Boot do firmware (0: DUMP não suportado ou não feito)
+    u32                     log_next;             // Primeiro registro ainda não recuperado
+    u32                     log_records;          // Registros recebidos (protegido por recv_lock)
+    struct smartlamp_sample *log_replay;          // Últimos LOG_REPLAY_LEN registros, para novos leitores (protegido por readers_lock)
+    u32                     log_replayed;         // Registros já guardados em log_replay
+
+    // Relógio do ESP32 (/sys/kernel/smartlamp/lampN/clock)
+    struct smartlamp_clock  clock;                // Correlação com o CLOCK_MONOTONIC
+    spinlock_t              clock_lock;           // Protege clock (usado também no callback das URBs)
+
+    // Estatísticas em /sys/kernel/debug/smartlamp/lampN
+    struct dentry          *debugfs;              // Diretório lampN
+    spinlock_t              stats_lock;           // Protege stats
+    struct smartlamp_cmd_stats stats[CMD_COUNT];  // Contadores por comando
+};
+
+#define to_smartlamp(k) container_of(k, struct smartlamp, kobj)
+
+// Leitor de /dev/smartlampN: cada open() tem sua própria fila de amostras.
+// O amostrador é o único produtor e o read() o único consumidor, então a kfifo dispensa lock entre os dois.
+struct smartlamp_reader {
+    struct smartlamp       *dev;                  // Lâmpada lida (referência no kobject)
+    struct list_head        node;                 // Entrada em smartlamp->readers
+    struct mutex            read_mutex;           // Serializa read() concorrentes no mesmo arquivo
+    DECLARE_KFIFO(fifo, struct smartlamp_sample, SAMPLE_FIFO_LEN); // Amostras ainda não lidas
+};
 
 // Variáveis globais do driver
-static char recv_line[MAX_RECV_LINE];              // Armazena dados vindos da USB até receber um caractere de nova linha '\n'
-static struct usb_device *smartlamp_device;        // Referência para o dispositivo USB
-static uint usb_in, usb_out;                       // Endereços das portas de entrada e saida da USB
-static char *usb_in_buffer, *usb_out_buffer;       // Buffers de entrada e saída da USB
-static char *cmd_buffer;                            // Buffer para montar o comando completo
-static int usb_max_size;                           // Tamanho máximo de uma mensagem USB
+static struct kobject *smartlamp_root;             // Diretório /sys/kernel/smartlamp, pai dos diretórios lampN
+static DEFINE_IDA(smartlamp_ida);                  // Numeração das lâmpadas (lamp0, lamp1, ...)
+static LIST_HEAD(smartlamp_list);                  // Lâmpadas conectadas
+static DEFINE_MUTEX(smartlamp_list_lock);          // Protege smartlamp_list
+
+// Onde a recuperação de cada ESP32 parou, guardado na desconexão: ao reconectar (mesmo em outra porta), o
+// backfill pede só os registros posteriores. A chave é o boot do firmware, que muda quando o ESP32 reinicia.
+#define LOG_RESUME_SLOTS 8
+struct smartlamp_log_resume {
+    u32 boot;                                      // 0: posição livre
+    u32 next;                                      // Primeiro registro ainda não recuperado
+    u64 live_ns;                                   // Última amostra recebida ao vivo antes da desconexão
+};
+static struct smartlamp_log_resume log_resume[LOG_RESUME_SLOTS];
+static DEFINE_MUTEX(log_resume_lock);              // Protege log_resume
+static struct dentry *smartlamp_debugfs;           // Diretório /sys/kernel/debug/smartlamp
+
+// Período do amostrador em segundo plano (0 desliga o amostrador)
+static unsigned int sample_period_ms = 1000;
+static int sample_period_set(const char *val, const struct kernel_param *kp);
+static const struct kernel_param_ops sample_period_ops = {
+    .set = sample_period_set,
+    .get = param_get_uint,
+};
+module_param_cb(sample_period_ms, &sample_period_ops, &sample_period_ms, 0644);
+MODULE_PARM_DESC(sample_period_ms, "Periodo (ms) de atualizacao dos sensores em segundo plano (0 desliga)");
+
+// Permite negociar o protocolo binário (desligado força o protocolo texto)
+static bool binary_proto = true;
+module_param(binary_proto, bool, 0444);
+MODULE_PARM_DESC(binary_proto, "Negocia o protocolo binario com o firmware (0 usa sempre texto)");
+
+// Recupera no probe as amostras que o firmware registrou enquanto a lâmpada estava desconectada
+static bool backfill = true;
+module_param(backfill, bool, 0644);
+MODULE_PARM_DESC(backfill, "Recupera no probe as amostras registradas pelo firmware durante a desconexao");
+
+// Tamanho da janela de comandos em andamento (quando o firmware aceita tags)
+static unsigned int max_inflight = 4;
+module_param(max_inflight, uint, 0444);
+MODULE_PARM_DESC(max_inflight, "Maximo de comandos em andamento por lampada (1 a 16)");
+
+// Velocidade da serial negociada no probe (DEFAULT_BAUD desliga a negociação)
+static unsigned int baud = 921600;
+module_param(baud, uint, 0444);
+MODULE_PARM_DESC(baud, "Velocidade da serial negociada com o firmware (9600 desliga a negociacao)");
+
+// Idade máxima do snapshot: leituras mais antigas que isso forçam uma atualização síncrona
+static unsigned int max_age_ms = 2000;
+module_param(max_age_ms, uint, 0644);
+MODULE_PARM_DESC(max_age_ms, "Idade maxima (ms) de um valor servido pelo sysfs antes de forcar nova leitura");
 
 // Informações de identificação do dispositivo USB (Vendor ID e Product ID)
 #define VENDOR_ID   0x10c4
 #define PRODUCT_ID  0xea60
 static const struct usb_device_id id_table[] = { { USB_DEVICE(VENDOR_ID, PRODUCT_ID) }, {} };
+MODULE_DEVICE_TABLE(usb, id_table);
 
 // Protótipos das funções
 static int  usb_probe(struct usb_interface *ifce, const struct usb_device_id *id); // Executado quando o dispositivo é conectado na USB
 static void usb_disconnect(struct usb_interface *ifce);                           // Executado quando o dispositivo USB é desconectado da USB
-static int  usb_send_cmd(char *cmd, int param, void *result_ptr);                 // Envia um comando para o dispositivo e processa a resposta
+static int  usb_send_cmd(struct smartlamp *dev, enum smartlamp_cmd cmd, int param, void *result_ptr); // Envia um comando para o dispositivo e processa a resposta
+static int  usb_send_cmd_args(struct smartlamp *dev, enum smartlamp_cmd cmd, const int *args, void *result_ptr); // Idem, com vários argumentos
+static int  usb_xfer_cmd(struct smartlamp *dev, const struct smartlamp_cmd_desc *desc, const int *args,
+                         void *result_ptr, struct smartlamp_xfer *xfer);          // Envio e resposta de um comando, sem contabilizar
+static int  usb_start_reading(struct smartlamp *dev);                            // Aloca e submete as URBs de leitura
+static void usb_stop_reading(struct smartlamp *dev);                             // Cancela e libera as URBs de leitura
+static void usb_read_complete(struct urb *urb);                                  // Callback de conclusão das URBs de leitura
+static int  smartlamp_refresh(struct smartlamp *dev);                            // Lê todos os sensores e atualiza o snapshot
+static void sampler_work_fn(struct work_struct *work);                           // Amostrador em segundo plano
+static void usb_fail_inflight(struct smartlamp *dev);                            // Acorda os comandos em andamento na desconexão
+static int  cp210x_setup(struct smartlamp *dev);                                 // Liga a UART da bridge em 8N1 a DEFAULT_BAUD
+static int  cp210x_set_baud(struct smartlamp *dev, u32 rate);                    // Ajusta a velocidade da UART da bridge
+static void smartlamp_negotiate_baud(struct smartlamp *dev, unsigned int target); // Troca a velocidade da serial com o firmware
+static void smartlamp_push_sample(struct smartlamp *dev, const struct smartlamp_snapshot *all); // Entrega uma leitura do amostrador aos leitores de /dev/smartlampN
+static void smartlamp_publish_sample(struct smartlamp *dev, struct smartlamp_sample *sample); // Numera e publica uma amostra no anel e nas filas
+static void sample_set_value(struct smartlamp_sample *sample, enum smartlamp_sensor sensor, long value); // Preenche o campo de um sensor no registro
+static int  parse_centi(const char *str, long *value);                           // Converte "25.30" para centésimos
+static int  parse_all(char *str, struct smartlamp_snapshot *result);             // Interpreta a resposta de GET_ALL
+static int  parse_ldr_stats(char *str, long *stats);                             // Interpreta a resposta de GET_LDR_STATS
+static int  parse_auto(char *str, long *fields);                                 // Interpreta a resposta de GET_AUTO
+static int  parse_all_ts(char *str, struct smartlamp_stamped *result);           // Interpreta a resposta de GET_ALL_TS
+static void smartlamp_clock_stamp(struct smartlamp *dev, struct smartlamp_stamped *st); // Correlaciona os relógios e data as amostras
+static bool smartlamp_clock_convert(struct smartlamp *dev, u32 us, u64 *ns);     // Instante do ESP32 no relógio do host
+static int  parse_dump(char *str, long *fields);                                 // Interpreta a resposta de DUMP
+static void smartlamp_backfill_work_fn(struct work_struct *work);                // Recupera os registros do firmware com DUMP e inicia o amostrador
+static void smartlamp_log_save(struct smartlamp *dev);                           // Guarda onde a recuperação parou (desconexão)
+static void smartlamp_ring_init(struct smartlamp_ring_header *hdr);              // Preenche o cabeçalho do anel mapeável
+static void smartlamp_debugfs_init(struct smartlamp *dev);                        // Cria /sys/kernel/debug/smartlamp/lampN
+static int  smartlamp_set_led(struct smartlamp *dev, int value);                 // SET_LED síncrono (descarta um valor pendente)
+static int  smartlamp_led_ramp(struct smartlamp *dev, int target, int ms, int curve); // Transição do LED feita no firmware
+static int  smartlamp_led_init(struct smartlamp *dev);                           // Registra o LED class da lâmpada
+static void smartlamp_led_work_fn(struct work_struct *work);                     // Envia o último brilho pedido ao LED class
+static void smartlamp_led_remove(struct smartlamp *dev);                         // Remove o LED class mantendo o brilho atual
+static void smartlamp_iio_work_fn(struct irq_work *work);                        // Dispara o gatilho IIO após uma amostra
+static int  smartlamp_iio_init(struct smartlamp *dev);                           // Registra o dispositivo IIO da lâmpada
+static void smartlamp_iio_remove(struct smartlamp *dev);                         // Remove o dispositivo IIO da lâmpada
+static void smartlamp_iio_update(struct smartlamp *dev, const struct smartlamp_sample *sample); // Entrega uma amostra ao gatilho IIO
+static long sample_get_value(const struct smartlamp_sample *sample, enum smartlamp_sensor sensor); // Lê o campo de um sensor no registro
+
+// Funções do dispositivo /dev/smartlampN
+static int          smartlamp_cdev_open(struct inode *inode, struct file *file);
+static int          smartlamp_cdev_release(struct inode *inode, struct file *file);
+static ssize_t      smartlamp_cdev_read(struct file *file, char __user *buf, size_t count, loff_t *ppos);
+static __poll_t     smartlamp_cdev_poll(struct file *file, poll_table *wait);
+static int          smartlamp_cdev_mmap(struct file *file, struct vm_area_struct *vma);
+
+static const struct file_operations smartlamp_fops = {
+    .owner   = THIS_MODULE,
+    .open    = smartlamp_cdev_open,
+    .release = smartlamp_cdev_release,
+    .read    = smartlamp_cdev_read,
+    .poll    = smartlamp_cdev_poll,
+    .mmap    = smartlamp_cdev_mmap,
+};
 
-// Funções para manipular os arquivos no /sys/kernel/smartlamp
+// Funções para manipular os arquivos no /sys/kernel/smartlamp/lampN
 static ssize_t attr_show(struct kobject *sys_obj, struct kobj_attribute *attr, char *buff); // Executado quando o arquivo é lido (e.g., cat)
 static ssize_t attr_store(struct kobject *sys_obj, struct kobj_attribute *attr, const char *buff, size_t count); // Executado quando o arquivo é escrito (e.g., echo)
 
-// Variáveis para criar os arquivos no /sys/kernel/smartlamp/{led, ldr, temp, hum}
-static struct kobj_attribute  led_attribute = __ATTR(led, S_IRUGO | S_IWUSR, attr_show, attr_store); // LED é leitura e escrita
-static struct kobj_attribute  ldr_attribute = __ATTR(ldr, S_IRUGO, attr_show, NULL); // LDR é somente leitura, então attr_store é NULL
-static struct kobj_attribute  temp_attribute = __ATTR(temp, S_IRUGO, attr_show, NULL); // Temp é somente leitura
-static struct kobj_attribute  hum_attribute = __ATTR(hum, S_IRUGO, attr_show, NULL);   // Hum é somente leitura
-
-static struct attribute      *attrs[]       = {
-    &led_attribute.attr,
-    &ldr_attribute.attr,
-    &temp_attribute.attr,
-    &hum_attribute.attr,
+static ssize_t stream_show(struct kobject *sys_obj, struct kobj_attribute *attr, char *buff);
+static ssize_t baud_show(struct kobject *sys_obj, struct kobj_attribute *attr, char *buff);
+static ssize_t ldr_stats_show(struct kobject *sys_obj, struct kobj_attribute *attr, char *buff);
+static ssize_t ldr_window_show(struct kobject *sys_obj, struct kobj_attribute *attr, char *buff);
+static ssize_t ldr_window_store(struct kobject *sys_obj, struct kobj_attribute *attr, const char *buff, size_t count);
+static ssize_t led_ramp_store(struct kobject *sys_obj, struct kobj_attribute *attr, const char *buff, size_t count);
+static ssize_t auto_show(struct kobject *sys_obj, struct kobj_attribute *attr, char *buff);
+static ssize_t auto_store(struct kobject *sys_obj, struct kobj_attribute *attr, const char *buff, size_t count);
+static ssize_t auto_config_show(struct kobject *sys_obj, struct kobj_attribute *attr, char *buff);
+static ssize_t auto_config_store(struct kobject *sys_obj, struct kobj_attribute *attr, const char *buff, size_t count);
+static ssize_t auto_status_show(struct kobject *sys_obj, struct kobj_attribute *attr, char *buff);
+static ssize_t sample_time_show(struct kobject *sys_obj, struct kobj_attribute *attr, char *buff);
+static ssize_t clock_show(struct kobject *sys_obj, struct kobj_attribute *attr, char *buff);
+static ssize_t stream_store(struct kobject *sys_obj, struct kobj_attribute *attr, const char *buff, size_t count);
+
+// Arquivos dos sensores (/sys/kernel/smartlamp/lampN/{led, ldr, temp, hum}), criados a partir de sensor_table.
+// Cada atributo sabe o índice do seu sensor, então attr_show e attr_store vão direto à entrada da tabela.
+struct smartlamp_sensor_attr {
+    struct kobj_attribute  attr;
+    enum smartlamp_sensor  sensor;
+};
+#define to_sensor_attr(a) container_of(a, struct smartlamp_sensor_attr, attr)
+
+static struct smartlamp_sensor_attr sensor_attrs[SENSOR_COUNT];  // Preenchidos em smartlamp_init
+static struct attribute *sensor_attr_list[SENSOR_COUNT + 1];
+static const struct attribute_group smartlamp_sensor_group = {
+    .attrs = sensor_attr_list,
+};
+
+// Variáveis para criar os demais arquivos no /sys/kernel/smartlamp/lampN/{stream, baud, ldr_stats, ldr_window, led_ramp, auto*,
+// sample_time, clock}
+static struct kobj_attribute  stream_attribute = __ATTR(stream, S_IRUGO | S_IWUSR, stream_show, stream_store); // Liga/desliga o modo STREAM
+static struct kobj_attribute  baud_attribute = __ATTR(baud, S_IRUGO, baud_show, NULL); // Velocidade negociada
+static struct kobj_attribute  ldr_stats_attribute = __ATTR(ldr_stats, S_IRUGO, ldr_stats_show, NULL); // Estatísticas da janela do LDR
+static struct kobj_attribute  ldr_window_attribute = __ATTR(ldr_window, S_IRUGO | S_IWUSR, ldr_window_show, ldr_window_store); // Tamanho da janela
+static struct kobj_attribute  led_ramp_attribute = __ATTR(led_ramp, S_IWUSR, NULL, led_ramp_store); // Transição do LED (somente escrita)
+static struct kobj_attribute  auto_attribute = __ATTR(auto, S_IRUGO | S_IWUSR, auto_show, auto_store); // Liga/desliga o controle automático
+static struct kobj_attribute  auto_config_attribute = __ATTR(auto_config, S_IRUGO | S_IWUSR, auto_config_show, auto_config_store); // Setpoint, ganhos e limites
+static struct kobj_attribute  auto_status_attribute = __ATTR(auto_status, S_IRUGO, auto_status_show, NULL); // LDR e LED do controle
+static struct kobj_attribute  sample_time_attribute = __ATTR(sample_time, S_IRUGO, sample_time_show, NULL); // Valores com o instante da amostra
+static struct kobj_attribute  clock_attribute = __ATTR(clock, S_IRUGO, clock_show, NULL); // Offset, deriva, ida e volta e jitter
+
+static struct attribute      *smartlamp_attrs[] = {
+    &stream_attribute.attr,
+    &baud_attribute.attr,
+    &ldr_stats_attribute.attr,
+    &ldr_window_attribute.attr,
+    &led_ramp_attribute.attr,
+    &auto_attribute.attr,
+    &auto_config_attribute.attr,
+    &auto_status_attribute.attr,
+    &sample_time_attribute.attr,
+    &clock_attribute.attr,
+    NULL
+};
+static const struct attribute_group smartlamp_group = {
+    .attrs = smartlamp_attrs,
+};
+static const struct attribute_group *smartlamp_groups[] = {
+    &smartlamp_sensor_group,
+    &smartlamp_group,
     NULL
 };
 
-static struct attribute_group attr_group    = { .attrs = attrs };
-static struct kobject        *sys_obj;                                             // Objeto sysfs para o diretório /sys/kernel/smartlamp
+// Libera a estrutura da lâmpada quando a última referência ao kobject é solta
+static void smartlamp_release(struct kobject *kobj) {
+    struct smartlamp *dev = to_smartlamp(kobj);
+
+    int i;
+
+    ida_free(&smartlamp_ida, dev->index);
+    usb_put_dev(dev->udev);
+    for (i = 0; i < MAX_INFLIGHT; i++)
+        kfree(dev->out_buf[i]);
+    vfree(dev->ring);
+    kfree(dev->log_replay);
+    kfree(dev);
+}
+
+static struct kobj_type smartlamp_ktype = {
+    .release        = smartlamp_release,
+    .sysfs_ops      = &kobj_sysfs_ops,
+    .default_groups = smartlamp_groups,
+};
 
 // Definição do driver USB
 static struct usb_driver smartlamp_driver = {
@@ -59,255 +649,2370 @@ static struct usb_driver smartlamp_driver = {
     .id_table    = id_table,        // Tabela com o VendorID e ProductID do dispositivo
 };
 
-module_usb_driver(smartlamp_driver);
+// Monta os atributos dos sensores a partir de sensor_table (somente leitura quando o sensor não tem comando de escrita)
+static void smartlamp_sensor_attrs_init(void) {
+    int i;
+
+    for (i = 0; i < SENSOR_COUNT; i++) {
+        struct smartlamp_sensor_attr *sa = &sensor_attrs[i];
+        bool writable = sensor_table[i].set >= 0;
+
+        sysfs_attr_init(&sa->attr.attr);
+        sa->attr.attr.name = sensor_table[i].name;
+        sa->attr.attr.mode = writable ? (S_IRUGO | S_IWUSR) : S_IRUGO;
+        sa->attr.show = attr_show;
+        sa->attr.store = writable ? attr_store : NULL;
+        sa->sensor = i;
+        sensor_attr_list[i] = &sa->attr.attr;
+    }
+}
+
+// Cria o diretório /sys/kernel/smartlamp e registra o driver USB
+static int __init smartlamp_init(void) {
+    int ret;
+
+    smartlamp_sensor_attrs_init();
+
+    smartlamp_root = kobject_create_and_add("smartlamp", kernel_kobj);
+    if (!smartlamp_root) {
+        printk(KERN_ERR "SmartLamp: falha ao criar o objeto sysfs\n");
+        return -ENOMEM;
+    }
+
+    // Sem debugfs (desligado ou sem memória) o driver funciona normalmente, só sem as estatísticas
+    smartlamp_debugfs = debugfs_create_dir("smartlamp", NULL);
+
+    ret = usb_register(&smartlamp_driver);
+    if (ret) {
+        debugfs_remove_recursive(smartlamp_debugfs);
+        kobject_put(smartlamp_root);
+    }
+    return ret;
+}
+
+static void __exit smartlamp_exit(void) {
+    usb_deregister(&smartlamp_driver);
+    debugfs_remove_recursive(smartlamp_debugfs);
+    kobject_put(smartlamp_root);
+}
+
+module_init(smartlamp_init);
+module_exit(smartlamp_exit);
 
 // ---
 
 // Executado quando o dispositivo é conectado na USB
 static int usb_probe(struct usb_interface *interface, const struct usb_device_id *id) {
     struct usb_endpoint_descriptor *usb_endpoint_in, *usb_endpoint_out;
+    struct smartlamp_stamped stamped;
+    struct smartlamp_snapshot all;
+    struct smartlamp *dev;
     long ldr_value;
+    u64 start_ns;
+    int i, ret;
 
     printk(KERN_INFO "SmartLamp: Dispositivo conectado ...\n");
 
-    // Cria o diretório /sys/kernel/smartlamp
-    sys_obj = kobject_create_and_add("smartlamp", kernel_kobj);
-    if (!sys_obj) {
-        printk(KERN_ERR "SmartLamp: falha ao criar o objeto sysfs\n");
-        return -ENOMEM;
-    }
-    // Cria os arquivos (atributos) no diretório sysfs
-    if (sysfs_create_group(sys_obj, &attr_group)) {
-        printk(KERN_ERR "SmartLamp: falha ao criar grupo de atributos\n");
-        kobject_put(sys_obj); // Limpa o objeto criado em caso de erro
+    dev = kzalloc(sizeof(*dev), GFP_KERNEL);
+    if (!dev)
         return -ENOMEM;
+
+    dev->index = ida_alloc(&smartlamp_ida, GFP_KERNEL);
+    if (dev->index < 0) {
+        ret = dev->index;
+        kfree(dev);
+        return ret;
     }
+    dev->udev = usb_get_dev(interface_to_usbdev(interface));
+    dev->interface = interface;
+    spin_lock_init(&dev->recv_lock);
+    init_waitqueue_head(&dev->inflight_wq);
+    dev->window = 1;
+    mutex_init(&dev->flight_mutex);
+    mutex_init(&dev->refresh_mutex);
+    seqlock_init(&dev->snapshot_lock);
+    INIT_DELAYED_WORK(&dev->sampler_work, sampler_work_fn);
+    init_usb_anchor(&dev->in_anchor);
+    INIT_LIST_HEAD(&dev->node);
+    INIT_LIST_HEAD(&dev->readers);
+    dev->stream_sensor = -1;
+    dev->ldr_window = LDR_WINDOW_DEFAULT;
+    dev->baud = DEFAULT_BAUD;
+    spin_lock_init(&dev->readers_lock);
+    init_waitqueue_head(&dev->read_wq);
+    spin_lock_init(&dev->stats_lock);
+    spin_lock_init(&dev->clock_lock);
+    init_irq_work(&dev->iio_work, smartlamp_iio_work_fn);
+    INIT_WORK(&dev->led_work, smartlamp_led_work_fn);
+    INIT_WORK(&dev->backfill_work, smartlamp_backfill_work_fn);
+    mutex_init(&dev->led_mutex);
+    dev->led_pending = -1;
+    // A partir daqui a estrutura é liberada por kobject_put (smartlamp_release)
+    kobject_init(&dev->kobj, &smartlamp_ktype);
 
     // Identifica e configura os endpoints de comunicação
-    smartlamp_device = interface_to_usbdev(interface);
     if (usb_find_common_endpoints(interface->cur_altsetting, &usb_endpoint_in, &usb_endpoint_out, NULL, NULL)) {
         printk(KERN_ERR "SmartLamp: Falha ao encontrar endpoints.\n");
-        kobject_put(sys_obj);
-        return -EIO;
+        ret = -EIO;
+        goto err_put;
     }
-    usb_max_size = usb_endpoint_maxp(usb_endpoint_in);
-    usb_in = usb_endpoint_in->bEndpointAddress;
-    usb_out = usb_endpoint_out->bEndpointAddress;
-
-    // Aloca memória para os buffers de comunicação
-    usb_in_buffer = kmalloc(usb_max_size, GFP_KERNEL);
-    usb_out_buffer = kmalloc(usb_max_size, GFP_KERNEL);
-    cmd_buffer = kmalloc(MAX_RECV_LINE, GFP_KERNEL);
-
-    if (!usb_in_buffer || !usb_out_buffer || !cmd_buffer) {
-        printk(KERN_ERR "SmartLamp: Falha na alocação de memória para os buffers.\n");
-        kfree(usb_in_buffer);
-        kfree(usb_out_buffer);
-        kfree(cmd_buffer);
-        kobject_put(sys_obj);
-        return -ENOMEM;
+    dev->usb_max_size = usb_endpoint_maxp(usb_endpoint_in);
+    dev->usb_in = usb_endpoint_in->bEndpointAddress;
+    dev->usb_out = usb_endpoint_out->bEndpointAddress;
+
+    // Aloca memória para os buffers de comandos (um por posição da janela)
+    for (i = 0; i < MAX_INFLIGHT; i++) {
+        dev->out_buf[i] = kmalloc(MAX_RECV_LINE, GFP_KERNEL);
+        if (!dev->out_buf[i]) {
+            printk(KERN_ERR "SmartLamp: Falha na alocação de memória para os buffers.\n");
+            ret = -ENOMEM;
+            goto err_put;
+        }
+    }
+
+    // Aloca o anel de amostras mapeável por /dev/smartlampN (zerado, alinhado em página)
+    dev->ring = vmalloc_user(RING_SIZE);
+    if (!dev->ring) {
+        printk(KERN_ERR "SmartLamp: Falha na alocação de memória para o anel de amostras.\n");
+        ret = -ENOMEM;
+        goto err_put;
     }
+    smartlamp_ring_init(dev->ring);
+
+    // Configura a UART da bridge CP210x; sem isso a serial depende do que outro driver deixou configurado
+    ret = cp210x_setup(dev);
+    if (ret) {
+        printk(KERN_ERR "SmartLamp: Falha ao configurar a UART do CP210x. Codigo: %d\n", ret);
+        goto err_put;
+    }
+
+    // Deixa as URBs de leitura pendentes: a partir daqui toda resposta é recebida de forma assíncrona
+    ret = usb_start_reading(dev);
+    if (ret) {
+        printk(KERN_ERR "SmartLamp: Falha ao iniciar a leitura da USB. Codigo: %d\n", ret);
+        goto err_put;
+    }
+
+    // Interrompe um fluxo STREAM deixado ligado por uma carga anterior do driver (firmwares antigos respondem "ERR")
+    usb_send_cmd(dev, CMD_STOP, 0, NULL);
 
     // Testa a comunicação lendo o valor inicial do LDR
-    if (usb_send_cmd("GET_LDR", 0, &ldr_value) >= 0) {
-        printk(KERN_INFO "SmartLamp: LDR Value inicial: %ld\n", ldr_value);
-    } else {
+    start_ns = ktime_get_ns();
+    ret = usb_send_cmd(dev, CMD_GET_LDR, 0, &ldr_value);
+    if (ret < 0 && baud != DEFAULT_BAUD) {
+        // Driver recarregado sem reiniciar a lâmpada: o firmware pode estar na velocidade negociada antes
+        trace_smartlamp_cmd_retry(dev->index, cmd_table[CMD_GET_LDR].wire, "baud", ktime_get_ns() - start_ns);
+        if (cp210x_set_baud(dev, baud) == 0 && (ret = usb_send_cmd(dev, CMD_GET_LDR, 0, &ldr_value)) >= 0)
+            dev->baud = baud;
+        else
+            cp210x_set_baud(dev, dev->baud);
+    }
+    if (ret >= 0)
+        printk(KERN_INFO "SmartLamp: LDR Value inicial: %ld (%u baud)\n", ldr_value, dev->baud);
+    else
         printk(KERN_ERR "SmartLamp: Falha ao ler valor inicial do LDR\n");
+
+    // Aumenta a velocidade da serial (firmwares antigos respondem "ERR" e ficam a 9600)
+    smartlamp_negotiate_baud(dev, baud);
+    printk(KERN_INFO "SmartLamp: Serial a %u baud\n", dev->baud);
+
+    // Verifica se o firmware devolve a tag dos comandos; só então vários comandos ficam em andamento
+    dev->tagged = true;
+    if (usb_send_cmd(dev, CMD_GET_LED, 0, NULL) == 0) {
+        dev->window = clamp_t(unsigned int, max_inflight, 1, MAX_INFLIGHT);
+    } else {
+        dev->tagged = false;
+    }
+    printk(KERN_INFO "SmartLamp: Tags %s (janela de %d comandos)\n", dev->tagged ? "suportadas" : "nao suportadas", dev->window);
+
+    // Negocia o protocolo binário; firmwares antigos respondem "ERR" e o driver continua em texto
+    if (binary_proto && usb_send_cmd(dev, CMD_PROTO_BIN, 0, NULL) == 0)
+        dev->use_binary = true;
+    printk(KERN_INFO "SmartLamp: Protocolo %s\n", dev->use_binary ? "binario" : "texto");
+
+    // Verifica se o firmware aceita o comando em lote GET_ALL (firmwares antigos respondem "ERR")
+    dev->has_get_all = (usb_send_cmd(dev, CMD_GET_ALL, 0, &all) == 0);
+    printk(KERN_INFO "SmartLamp: GET_ALL %s\n", dev->has_get_all ? "suportado" : "nao suportado");
+
+    // Verifica se o firmware informa os instantes das amostras; sem isso elas são datadas pela chegada da resposta
+    dev->has_get_all_ts = (usb_send_cmd(dev, CMD_GET_ALL_TS, 0, &stamped) == 0);
+    printk(KERN_INFO "SmartLamp: GET_ALL_TS %s\n", dev->has_get_all_ts ? "suportado" : "nao suportado");
+
+    // Cria o diretório /sys/kernel/smartlamp/lampN com os arquivos (atributos) da lâmpada
+    ret = kobject_add(&dev->kobj, smartlamp_root, "lamp%d", dev->index);
+    if (ret) {
+        printk(KERN_ERR "SmartLamp: falha ao criar o objeto sysfs\n");
+        goto err_stop;
+    }
+
+    // Cria /dev/smartlampN, que entrega cada amostra do amostrador como um registro struct smartlamp_sample
+    snprintf(dev->misc_name, sizeof(dev->misc_name), "smartlamp%d", dev->index);
+    dev->misc.minor = MISC_DYNAMIC_MINOR;
+    dev->misc.name = dev->misc_name;
+    dev->misc.fops = &smartlamp_fops;
+    dev->misc.parent = &interface->dev;
+    dev->misc.mode = 0444;
+    ret = misc_register(&dev->misc);
+    if (ret) {
+        printk(KERN_ERR "SmartLamp: falha ao criar /dev/%s\n", dev->misc_name);
+        goto err_del;
+    }
+
+    // Registra os sensores no subsistema IIO, com buffer e gatilho para leitura em bloco (libiio, iio_readdev)
+    ret = smartlamp_iio_init(dev);
+    if (ret) {
+        printk(KERN_ERR "SmartLamp: falha ao registrar o dispositivo IIO. Codigo: %d\n", ret);
+        goto err_misc;
+    }
+
+    // Registra o LED class, usado por animações e gatilhos (timer, heartbeat) sem esperar cada SET_LED
+    ret = smartlamp_led_init(dev);
+    if (ret) {
+        printk(KERN_ERR "SmartLamp: falha ao registrar o LED class. Codigo: %d\n", ret);
+        goto err_iio;
     }
 
+    smartlamp_debugfs_init(dev);
+
+    usb_set_intfdata(interface, dev);
+    mutex_lock(&smartlamp_list_lock);
+    list_add_tail(&dev->node, &smartlamp_list);
+    mutex_unlock(&smartlamp_list_lock);
+
+    // Inicia o amostrador em segundo plano, que mantém o snapshot dos sensores atualizado. Com backfill, ele só
+    // começa depois de recuperar as amostras registradas pelo firmware enquanto a lâmpada estava desconectada
+    // (ou o host desligado), para que os registros antigos venham antes das amostras ao vivo
+    WRITE_ONCE(dev->sampler_running, true);
+    if (backfill)
+        schedule_work(&dev->backfill_work);
+    else
+        schedule_delayed_work(&dev->sampler_work, 0);
+
+    printk(KERN_INFO "SmartLamp: Dispositivo disponivel em /sys/kernel/smartlamp/lamp%d e /dev/%s\n", dev->index, dev->misc_name);
     return 0;
+
+err_iio:
+    smartlamp_iio_remove(dev);
+err_misc:
+    misc_deregister(&dev->misc);
+err_del:
+    kobject_del(&dev->kobj);
+err_stop:
+    usb_stop_reading(dev);
+err_put:
+    kobject_put(&dev->kobj);
+    return ret;
 }
 
 // ---
 
 // Executado quando o dispositivo USB é desconectado da USB
 static void usb_disconnect(struct usb_interface *interface) {
-    printk(KERN_INFO "SmartLamp: Dispositivo desconectado.\n");
-    if (sys_obj) kobject_put(sys_obj);      // Remove os arquivos em /sys/kernel/smartlamp
-    kfree(usb_in_buffer);                   // Desaloca buffers
-    kfree(usb_out_buffer);
-    kfree(cmd_buffer);                      // Desaloca buffers
+    struct smartlamp *dev = usb_get_intfdata(interface);
+
+    printk(KERN_INFO "SmartLamp: Dispositivo lamp%d desconectado.\n", dev->index);
+    usb_set_intfdata(interface, NULL);
+
+    mutex_lock(&smartlamp_list_lock);
+    list_del(&dev->node);
+    mutex_unlock(&smartlamp_list_lock);
+
+    smartlamp_led_remove(dev);              // Desliga um gatilho ativo; o brilho atual é mantido
+
+    // Driver descarregado com a lâmpada conectada: desliga o fluxo e devolve a serial à velocidade inicial
+    // (os comandos falham sem demora se a lâmpada foi removida)
+    if (READ_ONCE(dev->stream_sensor) >= 0)
+        usb_send_cmd(dev, CMD_STOP, 0, NULL);
+    if (dev->baud != DEFAULT_BAUD)
+        usb_send_cmd(dev, CMD_BAUD, DEFAULT_BAUD, NULL);
+
+    usb_fail_inflight(dev);                 // Acorda os comandos em andamento e recusa os próximos
+    cancel_work_sync(&dev->backfill_work);  // Um DUMP em andamento falha sem demora
+    smartlamp_log_save(dev);                // Na próxima conexão, recupera só o que vier depois daqui
+    debugfs_remove_recursive(dev->debugfs); // Espera leituras de stats em andamento
+    smartlamp_iio_remove(dev);              // Remove iio:deviceN e o gatilho (desliga o buffer, se ativo)
+    misc_deregister(&dev->misc);            // Remove /dev/smartlampN (arquivos já abertos seguram o kobject)
+    wake_up_interruptible_all(&dev->read_wq); // Leitores bloqueados retornam -ENODEV
+    kobject_del(&dev->kobj);                // Remove os arquivos em /sys/kernel/smartlamp/lampN
+    WRITE_ONCE(dev->sampler_running, false); // Para o amostrador antes de cancelar a leitura
+    cancel_delayed_work_sync(&dev->sampler_work);
+
+    usb_stop_reading(dev);                  // Cancela as URBs de leitura pendentes
+    kobject_put(&dev->kobj);                // Desaloca a estrutura quando não houver mais referências
 }
 
 // ---
 
-// Envia um comando via USB, espera e armazena a resposta
-static int usb_send_cmd(char *cmd, int param, void *result_ptr) {
-    int recv_size = 0;
-    int ret, actual_size, i;
-    int retries = 20;
-    char resp_expected[MAX_RECV_LINE];
-    char *start_of_value;
-
-    memset(recv_line, 0, MAX_RECV_LINE);
-    memset(cmd_buffer, 0, MAX_RECV_LINE);
-    memset(resp_expected, 0, MAX_RECV_LINE);
-
-    // Monta o comando de acordo com o parâmetro 'cmd'
-    if (strcmp(cmd, "SET_LED") == 0) {
-        snprintf(cmd_buffer, MAX_RECV_LINE, "SET_LED %d\n", param);
-        snprintf(resp_expected, MAX_RECV_LINE, "RES SET_LED");
-    } else if (strcmp(cmd, "GET_LED") == 0) {
-        snprintf(cmd_buffer, MAX_RECV_LINE, "GET_LED\n");
-        snprintf(resp_expected, MAX_RECV_LINE, "RES GET_LED");
-    } else if (strcmp(cmd, "GET_LDR") == 0) {
-        snprintf(cmd_buffer, MAX_RECV_LINE, "GET_LDR\n");
-        snprintf(resp_expected, MAX_RECV_LINE, "RES GET_LDR");
-    } else if (strcmp(cmd, "GET_TEMP") == 0) {
-        snprintf(cmd_buffer, MAX_RECV_LINE, "GET_TEMP\n");
-        snprintf(resp_expected, MAX_RECV_LINE, "RES GET_TEMP");
-    } else if (strcmp(cmd, "GET_HUM") == 0) {
-        snprintf(cmd_buffer, MAX_RECV_LINE, "GET_HUM\n");
-        snprintf(resp_expected, MAX_RECV_LINE, "RES GET_HUM");
-    } else {
-        printk(KERN_ERR "SmartLamp: Comando desconhecido: %s\n", cmd);
-        return -1;
-    }
-    printk(KERN_INFO "SmartLamp: Enviando comando: %s", cmd_buffer);
+// Aloca as URBs de leitura e as deixa submetidas no endpoint de entrada.
+// Cada URB, ao ser concluída, entrega os bytes para o montador de linhas e é submetida novamente.
+static int usb_start_reading(struct smartlamp *dev) {
+    struct urb *urb;
+    char *buf;
+    int i, ret;
 
-    // Envia o comando para o dispositivo USB
-    ret = usb_bulk_msg(smartlamp_device, usb_sndbulkpipe(smartlamp_device, usb_out),
-                       cmd_buffer, strlen(cmd_buffer), &actual_size, 1000);
-    if (ret) {
-        printk(KERN_ERR "SmartLamp: Erro de codigo %d ao enviar comando!\n", ret);
-        return -1;
-    }
+    dev->recv_size = 0;
+    dev->frame_size = 0;
 
-    // Espera e lê a resposta do dispositivo
-    while (retries > 0) {
-        ret = usb_bulk_msg(smartlamp_device, usb_rcvbulkpipe(smartlamp_device, usb_in),
-                          usb_in_buffer, min(usb_max_size, MAX_RECV_LINE), &actual_size, 1000);
-        if (ret) {
-            printk(KERN_ERR "SmartLamp: Erro ao ler dados da USB (tentativa %d). Codigo: %d\n", retries, ret);
-            retries--;
-            continue;
+    for (i = 0; i < NUM_IN_URBS; i++) {
+        urb = usb_alloc_urb(0, GFP_KERNEL);
+        if (!urb) {
+            ret = -ENOMEM;
+            goto err;
         }
+        dev->in_urbs[i] = urb;
 
-        // Processa os dados recebidos, procurando por uma nova linha
-        for (i = 0; i < actual_size; i++) {
-            if (usb_in_buffer[i] == '\n' || recv_size >= MAX_RECV_LINE - 1) {
-                recv_line[recv_size] = '\0';
-                printk(KERN_INFO "SmartLamp: Resposta recebida: %s\n", recv_line);
-
-                // Verifica se a resposta corresponde ao comando enviado
-                if (strncmp(recv_line, resp_expected, strlen(resp_expected)) == 0) {
-                    start_of_value = recv_line + strlen(resp_expected) + 1;
-
-                    // Lógica de conversão da string da resposta para um número inteiro
-                    if (strcmp(cmd, "GET_TEMP") == 0 || strcmp(cmd, "GET_HUM") == 0) {
-                        int integer_part, decimal_part;
-                        // O sscanf para floats causa erro no kernel. A solução é ler como inteiros.
-                        if (sscanf(start_of_value, "%d.%d", &integer_part, &decimal_part) == 2) {
-                            if (result_ptr) {
-                                // Armazena o valor em um long, multiplicando por 100 para manter a precisão
-                                *(long *)result_ptr = integer_part * 100 + decimal_part;
-                                printk(KERN_INFO "SmartLamp: Valor inteiro extraído (com precisão): %ld\n", *(long *)result_ptr);
-                                return 0;
-                            }
-                        }
-                    } else { // GET_LDR, GET_LED
-                        long long_value;
-                        // Usa sscanf para inteiros, que é mais robusto com espaços em branco
-                        if (sscanf(start_of_value, "%ld", &long_value) == 1) {
-                            if (result_ptr) {
-                                *(long *)result_ptr = long_value;
-                                printk(KERN_INFO "SmartLamp: Valor inteiro extraído: %ld\n", long_value);
-                                return 0;
-                            }
-                        }
-                    }
-
-                    printk(KERN_ERR "SmartLamp: Erro ao converter o valor da resposta.\n");
-                    return -1;
-                }
-                recv_size = 0;
-                memset(recv_line, 0, MAX_RECV_LINE);
-            } else {
-                recv_line[recv_size++] = usb_in_buffer[i];
-            }
+        buf = usb_alloc_coherent(dev->udev, dev->usb_max_size, GFP_KERNEL, &urb->transfer_dma);
+        if (!buf) {
+            ret = -ENOMEM;
+            goto err;
+        }
+        usb_fill_bulk_urb(urb, dev->udev, usb_rcvbulkpipe(dev->udev, dev->usb_in),
+                          buf, dev->usb_max_size, usb_read_complete, dev);
+        urb->transfer_flags |= URB_NO_TRANSFER_DMA_MAP;
+
+        usb_anchor_urb(urb, &dev->in_anchor);
+        ret = usb_submit_urb(urb, GFP_KERNEL);
+        if (ret) {
+            usb_unanchor_urb(urb);
+            goto err;
         }
-        retries--;
     }
+    return 0;
 
-    printk(KERN_ERR "SmartLamp: Timeout - não recebeu resposta esperada\n");
-    return -1;
+err:
+    usb_stop_reading(dev);
+    return ret;
 }
 
-// ---
+// Cancela todas as URBs de leitura e libera seus buffers
+static void usb_stop_reading(struct smartlamp *dev) {
+    struct urb *urb;
+    int i;
 
-// Executado quando o arquivo /sys/kernel/smartlamp/{led, ldr, temp, hum} é lido (e.g., cat /sys/kernel/smartlamp/led)
-static ssize_t attr_show(struct kobject *sys_obj, struct kobj_attribute *attr, char *buff) {
-    const char *attr_name = attr->attr.name;
+    usb_kill_anchored_urbs(&dev->in_anchor);
+    for (i = 0; i < NUM_IN_URBS; i++) {
+        urb = dev->in_urbs[i];
+        if (!urb)
+            continue;
+        if (urb->transfer_buffer)
+            usb_free_coherent(dev->udev, dev->usb_max_size, urb->transfer_buffer, urb->transfer_dma);
+        usb_free_urb(urb);
+        dev->in_urbs[i] = NULL;
+    }
+}
+
+// Envia uma requisição de controle do fabricante para a interface da bridge CP210x
+static int cp210x_request(struct smartlamp *dev, u8 request, u16 value, const void *data, u16 size) {
+    return usb_control_msg_send(dev->udev, 0, request, CP210X_REQTYPE_HOST_TO_DEVICE, value,
+                                dev->interface->cur_altsetting->desc.bInterfaceNumber,
+                                data, size, USB_CTRL_SET_TIMEOUT, GFP_KERNEL);
+}
+
+// Ajusta a velocidade da UART da bridge e descarta o que estiver sendo montado (bytes recebidos na
+// troca de velocidade não formam uma resposta válida)
+static int cp210x_set_baud(struct smartlamp *dev, u32 rate) {
+    __le32 value = cpu_to_le32(rate);
+    unsigned long flags;
     int ret;
-    long int_value;
-
-    printk(KERN_INFO "SmartLamp: Lendo %s ...\n", attr_name);
-
-    // Chama a função de envio de comando e lê o valor
-    if (strcmp(attr_name, "led") == 0) {
-        ret = usb_send_cmd("GET_LED", 0, &int_value);
-        if (ret == 0) return sprintf(buff, "%ld\n", int_value);
-    } else if (strcmp(attr_name, "ldr") == 0) {
-        ret = usb_send_cmd("GET_LDR", 0, &int_value);
-        if (ret == 0) return sprintf(buff, "%ld\n", int_value);
-    } else if (strcmp(attr_name, "temp") == 0) { // Comando GET_TEMP
-        ret = usb_send_cmd("GET_TEMP", 0, &int_value);
-        if (ret == 0) {
-             // Formata o valor inteiro para um float de duas casas decimais
-             return sprintf(buff, "%ld.%02ld\n", int_value / 100, int_value % 100);
-        }
-    } else if (strcmp(attr_name, "hum") == 0) {  // Comando GET_HUM
-        ret = usb_send_cmd("GET_HUM", 0, &int_value);
-        if (ret == 0) {
-            // Formata o valor inteiro para um float de duas casas decimais
-            return sprintf(buff, "%ld.%02ld\n", int_value / 100, int_value % 100);
-        }
-    } else {
-        printk(KERN_ERR "SmartLamp: Atributo desconhecido: %s\n", attr_name);
-        return -EINVAL;
+
+    ret = cp210x_request(dev, CP210X_SET_BAUDRATE, 0, &value, sizeof(value));
+    spin_lock_irqsave(&dev->recv_lock, flags);
+    dev->recv_size = 0;
+    dev->frame_size = 0;
+    spin_unlock_irqrestore(&dev->recv_lock, flags);
+    return ret;
+}
+
+// Liga a UART da bridge em 8N1 a DEFAULT_BAUD, a configuração com que o firmware inicia
+static int cp210x_setup(struct smartlamp *dev) {
+    int ret;
+
+    ret = cp210x_request(dev, CP210X_IFC_ENABLE, CP210X_UART_ENABLE, NULL, 0);
+    if (!ret)
+        ret = cp210x_request(dev, CP210X_SET_LINE_CTL, CP210X_LINE_8N1, NULL, 0);
+    if (!ret)
+        ret = cp210x_set_baud(dev, DEFAULT_BAUD);
+    return ret;
+}
+
+// Negocia uma nova velocidade: o firmware responde "RES BAUD 1" ainda na velocidade atual e troca logo em
+// seguida; a bridge acompanha e um comando na nova velocidade confirma a troca. Sem essa confirmação o
+// firmware volta sozinho para DEFAULT_BAUD depois de BAUD_CONFIRM_MS, e o driver faz o mesmo.
+static void smartlamp_negotiate_baud(struct smartlamp *dev, unsigned int target) {
+    if (target == dev->baud)
+        return;
+    if (usb_send_cmd(dev, CMD_BAUD, target, NULL) < 0) {
+        printk(KERN_INFO "SmartLamp: Firmware nao aceitou %u baud\n", target);
+        return;
     }
 
-    printk(KERN_ERR "SmartLamp: Erro ao ler %s\n", attr_name);
-    return -EIO;
+    if (cp210x_set_baud(dev, target) == 0 && usb_send_cmd(dev, CMD_GET_LED, 0, NULL) == 0) {
+        dev->baud = target;
+        return;
+    }
+
+    printk(KERN_ERR "SmartLamp: Sem resposta a %u baud, voltando para %u\n", target, DEFAULT_BAUD);
+    msleep(BAUD_CONFIRM_MS + 200);
+    cp210x_set_baud(dev, DEFAULT_BAUD);
+    dev->baud = DEFAULT_BAUD;
 }
 
-// ---
+// Procura o comando em andamento com a tag recebida. Chamada com recv_lock adquirido.
+static struct smartlamp_waiter *usb_find_waiter(struct smartlamp *dev, u8 tag) {
+    int i;
 
-// Executado quando o arquivo /sys/kernel/smartlamp/{led} é escrito (e.g., echo "100" | sudo tee -a /sys/kernel/smartlamp/led)
-static ssize_t attr_store(struct kobject *sys_obj, struct kobj_attribute *attr, const char *buff, size_t count) {
-    long ret, value;
-    const char *attr_name = attr->attr.name;
+    for (i = 0; i < MAX_INFLIGHT; i++)
+        if (dev->inflight[i] && dev->inflight[i]->tag == tag)
+            return dev->inflight[i];
+    return NULL;
+}
 
-    // Converte o valor recebido da string para long
-    if (sscanf(buff, "%ld", &value) != 1) {
-        printk(KERN_ALERT "SmartLamp: valor de %s invalido.\n", attr_name);
-        return -EACCES;
+// Retira o comando da janela e acorda quem o espera. Chamada com recv_lock adquirido.
+static void usb_complete_waiter(struct smartlamp *dev, struct smartlamp_waiter *waiter) {
+    waiter->recv_ns = ktime_get_ns();
+    if (!waiter->status)
+        trace_smartlamp_resp_match(dev->index, waiter->tag, waiter->binary, waiter->recv_ns - waiter->sent_ns);
+    dev->inflight[waiter->slot] = NULL;
+    dev->inflight_count--;
+    waiter->slot = -1;
+    complete(&waiter->done);
+    wake_up(&dev->inflight_wq);
+}
+
+// Amostra enviada espontaneamente pelo firmware no modo STREAM ("STR LDR 42 1234567" ou "STR TEMP 25.30 1234567").
+// O último campo é o micros() da amostra, convertido pela correlação dos relógios; sem ele (firmware antigo) ou
+// antes da primeira correlação, vale o instante da chegada. Chamada com recv_lock adquirido (contexto de interrupção).
+static void usb_stream_line(struct smartlamp *dev, char *line) {
+    struct smartlamp_sample sample;
+    char *value = strchr(line, ' '), *stamp;
+    u32 us;
+    long v;
+    int i;
+
+    if (!value)
+        return;
+    *value++ = '\0';
+    stamp = strchr(value, ' ');
+    if (stamp)
+        *stamp++ = '\0';
+
+    for (i = 0; i < SENSOR_COUNT && strcmp(line, sensor_table[i].wire) != 0; i++)
+        ;
+    if (i == SENSOR_COUNT)
+        return;
+    if (sensor_table[i].fmt == FMT_CENTI ? parse_centi(value, &v) : kstrtol(value, 10, &v))
+        return;
+
+    memset(&sample, 0, sizeof(sample));
+    if (!stamp || kstrtou32(stamp, 10, &us) || !smartlamp_clock_convert(dev, us, &sample.timestamp_ns))
+        sample.timestamp_ns = ktime_get_ns();
+    sample.valid = BIT(i) | SMARTLAMP_SAMPLE_STREAM;
+    sample_set_value(&sample, i, v);
+    smartlamp_publish_sample(dev, &sample);
+}
+
+// Registro do firmware enviado durante um DUMP: número, idade (ms), LED e LDR (um byte cada) e temperatura e
+// umidade (16 bits cada, S16_MIN se o DHT não respondeu). O instante é estimado pela idade na chegada.
+// Chamada com recv_lock adquirido (contexto de interrupção).
+static void usb_log_frame(struct smartlamp *dev, const struct smartlamp_frame *frame) {
+    struct smartlamp_sample sample;
+    u32 age = le32_to_cpu(frame->value[1]), leds = le32_to_cpu(frame->value[2]);
+    u32 dht = le32_to_cpu(frame->value[3]);
+    s16 temp = dht & 0xffff, hum = dht >> 16;
+
+    memset(&sample, 0, sizeof(sample));
+    sample.timestamp_ns = ktime_get_ns() - (u64)age * NSEC_PER_MSEC;
+    sample.valid = SMARTLAMP_VALID_LED | SMARTLAMP_VALID_LDR | SMARTLAMP_SAMPLE_LOG;
+    sample.led = leds & 0xff;
+    sample.ldr = (leds >> 8) & 0xff;
+    if (temp != S16_MIN) {
+        sample.temp = temp;
+        sample.valid |= SMARTLAMP_VALID_TEMP;
+    }
+    if (hum != S16_MIN) {
+        sample.hum = hum;
+        sample.valid |= SMARTLAMP_VALID_HUM;
+    }
+    dev->log_records++;
+    smartlamp_publish_sample(dev, &sample);
+}
+
+// Entrega uma linha completa ao comando com a mesma tag ("#<tag> RES ...").
+// Linhas sem tag (firmware antigo) só são entregues quando há um único comando em andamento:
+// nesse caso, "ERR ..." responde ao último comando recebido pelo firmware, que é esse comando.
+// Respostas atrasadas ou avulsas não encontram dono e são descartadas. Chamada com recv_lock adquirido.
+static void usb_dispatch_line(struct smartlamp *dev, char *line) {
+    struct smartlamp_waiter *waiter = NULL;
+    unsigned int tag;
+    int i, n = 0;
+
+    // Amostras do modo STREAM não respondem a nenhum comando: vão direto para o fluxo de amostras
+    if (strncmp(line, "STR ", 4) == 0) {
+        usb_stream_line(dev, line + 4);
+        return;
     }
 
-    // Verifica se é um atributo válido para escrita
-    if (strcmp(attr_name, "led") == 0) {
-        // Valida o range do LED (0-100)
-        if (value < 0 || value > 100) {
-            printk(KERN_ALERT "SmartLamp: valor do LED deve estar entre 0 e 100.\n");
-            return -EINVAL;
+    if (line[0] == '#') {
+        if (sscanf(line, "#%u %n", &tag, &n) != 1 || n == 0)
+            return;
+        waiter = usb_find_waiter(dev, tag);
+        line += n;
+    } else if (dev->inflight_count == 1) {
+        for (i = 0; i < MAX_INFLIGHT && !waiter; i++)
+            waiter = dev->inflight[i];
+    }
+
+    // O prefixo precisa terminar numa palavra: "RES GET_ALL" não aceita uma resposta atrasada de "RES GET_ALL_TS"
+    if (waiter && !waiter->binary &&
+        ((strncmp(line, waiter->resp_expected, waiter->resp_len) == 0 &&
+          (line[waiter->resp_len] == ' ' || line[waiter->resp_len] == '\0')) ||
+         strncmp(line, "ERR", 3) == 0)) {
+        strscpy(waiter->line, line, MAX_RECV_LINE);
+        usb_complete_waiter(dev, waiter);
+    }
+}
+
+// Entrega um quadro binário completo ao comando com o mesmo número de sequência.
+// Quadros com CRC inválido são descartados. Chamada com recv_lock adquirido.
+static void usb_dispatch_frame(struct smartlamp *dev, const struct smartlamp_frame *frame) {
+    struct smartlamp_waiter *waiter;
+
+    if (crc_ccitt(0xffff, &frame->len, BIN_CRC_LEN) != le16_to_cpu(frame->crc) ||
+        frame->len > sizeof(frame->value)) {
+        dev->crc_errors++;
+        printk_ratelimited(KERN_ERR "SmartLamp: Quadro binario corrompido descartado (%lu)\n", dev->crc_errors);
+        return;
+    }
+
+    // Registros do DUMP não respondem a um quadro: vão direto para o fluxo de amostras
+    if (frame->op == BIN_OP_LOG_RECORD) {
+        usb_log_frame(dev, frame);
+        return;
+    }
+
+    waiter = usb_find_waiter(dev, frame->seq);
+    if (waiter && waiter->binary &&
+        (frame->op == (waiter->bin_op | BIN_OP_RESP) || frame->op == BIN_OP_ERR)) {
+        waiter->frame = *frame;
+        usb_complete_waiter(dev, waiter);
+    }
+}
+
+// Desconexão: acorda todos os comandos em andamento com -ENODEV e recusa os próximos
+static void usb_fail_inflight(struct smartlamp *dev) {
+    unsigned long flags;
+    int i;
+
+    spin_lock_irqsave(&dev->recv_lock, flags);
+    dev->disconnected = true;
+    for (i = 0; i < MAX_INFLIGHT; i++) {
+        if (dev->inflight[i]) {
+            dev->inflight[i]->status = -ENODEV;
+            usb_complete_waiter(dev, dev->inflight[i]);
         }
+    }
+    spin_unlock_irqrestore(&dev->recv_lock, flags);
+    wake_up_all(&dev->inflight_wq);
+}
 
-        printk(KERN_INFO "SmartLamp: Setando %s para %ld ...\n", attr_name, value);
+// Tenta ocupar uma posição na janela e escolher uma tag livre para o comando.
+// Retorna verdadeiro quando conseguiu ou quando o dispositivo foi desconectado (slot continua -1).
+static bool usb_claim_slot(struct smartlamp *dev, struct smartlamp_waiter *waiter) {
+    unsigned long flags;
+    int i;
 
-        // Envia o comando SET_LED com o valor
-        ret = usb_send_cmd("SET_LED", (int)value, NULL);
-        if (ret < 0) {
-            printk(KERN_ALERT "SmartLamp: erro ao setar o valor do %s.\n", attr_name);
-            return -EIO;
+    spin_lock_irqsave(&dev->recv_lock, flags);
+    if (dev->disconnected) {
+        spin_unlock_irqrestore(&dev->recv_lock, flags);
+        return true;
+    }
+    if (dev->inflight_count >= dev->window) {
+        spin_unlock_irqrestore(&dev->recv_lock, flags);
+        return false;
+    }
+
+    // Com no máximo MAX_INFLIGHT tags em uso sempre existe uma livre entre as 256
+    do {
+        waiter->tag = dev->next_tag++;
+    } while (usb_find_waiter(dev, waiter->tag));
+
+    for (i = 0; dev->inflight[i]; i++)
+        ;
+    dev->inflight[i] = waiter;
+    dev->inflight_count++;
+    waiter->slot = i;
+    spin_unlock_irqrestore(&dev->recv_lock, flags);
+    return true;
+}
+
+// Monta linhas a partir dos bytes recebidos, entregando cada uma ao encontrar '\n'.
+// Um byte BIN_SYNC no início de uma linha indica um quadro binário de tamanho fixo.
+// Chamada com recv_lock adquirido.
+static void usb_recv_bytes(struct smartlamp *dev, const char *data, int len) {
+    int i;
+
+    for (i = 0; i < len; i++) {
+        if (dev->frame_size > 0) {
+            dev->recv_frame[dev->frame_size++] = data[i];
+            if (dev->frame_size == BIN_FRAME_SIZE) {
+                usb_dispatch_frame(dev, (struct smartlamp_frame *)dev->recv_frame);
+                dev->frame_size = 0;
+            }
+        } else if (dev->recv_size == 0 && (u8)data[i] == BIN_SYNC) {
+            dev->recv_frame[0] = BIN_SYNC;
+            dev->frame_size = 1;
+        } else if (data[i] == '\n' || dev->recv_size >= MAX_RECV_LINE - 1) {
+            dev->recv_line[dev->recv_size] = '\0';
+            usb_dispatch_line(dev, dev->recv_line);
+            dev->recv_size = 0;
+        } else if (data[i] != '\r') {
+            dev->recv_line[dev->recv_size++] = data[i];
         }
-    } else if (strcmp(attr_name, "ldr") == 0 || strcmp(attr_name, "temp") == 0 || strcmp(attr_name, "hum") == 0) {
-        // LDR, TEMP, HUM são somente leitura
-        printk(KERN_ALERT "SmartLamp: %s é somente leitura.\n", attr_name);
-        return -EACCES;
-    } else {
-        printk(KERN_ERR "SmartLamp: Atributo desconhecido: %s\n", attr_name);
+    }
+}
+
+// Callback de conclusão das URBs de leitura (executado em contexto de interrupção)
+static void usb_read_complete(struct urb *urb) {
+    struct smartlamp *dev = urb->context;
+    unsigned long flags;
+    int ret;
+
+    switch (urb->status) {
+    case 0:
+        spin_lock_irqsave(&dev->recv_lock, flags);
+        dev->rx_bytes += urb->actual_length;
+        dev->rx_chunks++;
+        if (trace_smartlamp_rx_chunk_enabled()) {
+            u64 now = ktime_get_ns();
+
+            trace_smartlamp_rx_chunk(dev->index, urb->actual_length, dev->rx_last_ns ? now - dev->rx_last_ns : 0);
+            dev->rx_last_ns = now;
+        }
+        usb_recv_bytes(dev, urb->transfer_buffer, urb->actual_length);
+        spin_unlock_irqrestore(&dev->recv_lock, flags);
+        break;
+    case -ENOENT:       // URB cancelada (usb_kill_anchored_urbs)
+    case -ECONNRESET:
+    case -ESHUTDOWN:    // Dispositivo desconectado
+    case -EPIPE:
+        return;
+    default:
+        printk_ratelimited(KERN_ERR "SmartLamp: Erro ao ler dados da USB. Codigo: %d\n", urb->status);
+        break;
+    }
+
+    // Resubmete a URB para manter a leitura sempre pendente
+    usb_anchor_urb(urb, &dev->in_anchor);
+    ret = usb_submit_urb(urb, GFP_ATOMIC);
+    if (ret) {
+        usb_unanchor_urb(urb);
+        if (ret != -ENODEV && ret != -EPERM)
+            printk_ratelimited(KERN_ERR "SmartLamp: Erro ao resubmeter URB de leitura. Codigo: %d\n", ret);
+    }
+}
+
+// ---
+
+// Converte um valor com duas casas decimais (e.g., "25.30" ou "-1.50") para centésimos.
+// O sscanf para floats causa erro no kernel. A solução é ler como inteiros.
+static int parse_centi(const char *str, long *value) {
+    int integer_part, decimal_part;
+    bool negative;
+
+    str = skip_spaces(str);
+    negative = (*str == '-');
+    if (negative)
+        str++;
+    if (sscanf(str, "%d.%d", &integer_part, &decimal_part) != 2 || integer_part < 0 || decimal_part < 0)
         return -EINVAL;
+
+    // Armazena o valor em um long, multiplicando por 100 para manter a precisão
+    *value = integer_part * 100L + decimal_part;
+    if (negative)
+        *value = -*value;
+    return 0;
+}
+
+// Interpreta a resposta de GET_ALL ("<led> <ldr> <temp> <hum>") numa só passada.
+// Campos que não puderem ser convertidos (e.g., "nan" quando o DHT falha) ficam inválidos.
+static int parse_all(char *str, struct smartlamp_snapshot *result) {
+    char *token;
+    int i;
+
+    result->valid = 0;
+    for (i = 0; i < SENSOR_COUNT && (token = strsep(&str, " ")); i++) {
+        if (sensor_table[i].fmt == FMT_CENTI) {
+            if (parse_centi(token, &result->value[i]) == 0)
+                result->valid |= BIT(i);
+        } else if (kstrtol(token, 10, &result->value[i]) == 0) {
+            result->valid |= BIT(i);
+        }
     }
+    return i == SENSOR_COUNT ? 0 : -EINVAL;
+}
 
-    return count;
-}
\ No newline at end of file
+// Interpreta a resposta de GET_LDR_STATS ("<média> <mínimo> <máximo> <variância> <amostras>")
+static int parse_ldr_stats(char *str, long *stats) {
+    char *token;
+    int i;
+
+    for (i = 0; i < LDR_STAT_COUNT && (token = strsep(&str, " ")); i++)
+        if (parse_centi(token, &stats[i]))
+            return -EINVAL;
+    return i == LDR_STAT_COUNT ? 0 : -EINVAL;
+}
+
+// Interpreta a resposta de GET_AUTO: inteiros, exceto o LDR e o LED do controle (duas casas decimais)
+static int parse_auto(char *str, long *fields) {
+    char *token;
+    int i;
+
+    for (i = 0; i < AUTO_FIELD_COUNT && (token = strsep(&str, " ")); i++) {
+        if (i == AUTO_LDR || i == AUTO_LED ? parse_centi(token, &fields[i]) : kstrtol(token, 10, &fields[i]))
+            return -EINVAL;
+    }
+    return i == AUTO_FIELD_COUNT ? 0 : -EINVAL;
+}
+
+// Interpreta a resposta de DUMP ("<enviados> <próximo> <boot>")
+static int parse_dump(char *str, long *fields) {
+    if (sscanf(str, "%ld %ld %ld", &fields[DUMP_SENT], &fields[DUMP_NEXT], &fields[DUMP_BOOT]) != DUMP_FIELD_COUNT ||
+        fields[DUMP_SENT] < 0)
+        return -EINVAL;
+    return 0;
+}
+
+// Interpreta a resposta de GET_ALL_TS ("<led> <ldr> <temp> <hum> <agora> <ldr_us> <dht_us>")
+static int parse_all_ts(char *str, struct smartlamp_stamped *result) {
+    // Os instantes primeiro: parse_all separa a linha em pedaços
+    if (sscanf(str, "%*s %*s %*s %*s %u %u %u", &result->now_us, &result->ldr_us, &result->dht_us) != 3)
+        return -EINVAL;
+    return parse_all(str, &result->all);
+}
+
+// Monta um quadro binário com o opcode, número de sequência e os argumentos do comando
+static void bin_build(struct smartlamp_frame *frame, u8 op, u8 seq, const int *args, int nargs) {
+    int i;
+
+    memset(frame, 0, BIN_FRAME_SIZE);
+    frame->sync = BIN_SYNC;
+    frame->op = op;
+    frame->seq = seq;
+    for (i = 0; i < nargs && i < BIN_MAX_VALUES; i++)
+        frame->value[i] = cpu_to_le32(args[i]);
+    frame->len = i * sizeof(__le32);
+    frame->crc = cpu_to_le16(crc_ccitt(0xffff, &frame->len, BIN_CRC_LEN));
+}
+
+// Interpreta um quadro de resposta conforme o formato do comando (o opcode já foi conferido na entrega)
+static int bin_parse(const struct smartlamp_cmd_desc *desc, const struct smartlamp_frame *frame, void *result_ptr) {
+    struct smartlamp_snapshot *all = result_ptr;
+    int count = frame->len / sizeof(__le32);
+    s32 value;
+    int i;
+
+    if (frame->op == BIN_OP_ERR) {
+        printk(KERN_ERR "SmartLamp: Comando %s recusado pelo dispositivo\n", desc->wire);
+        return -1;
+    }
+
+    switch (desc->fmt) {
+    case FMT_ALL:
+        if (count < SENSOR_COUNT)
+            break;
+        all->valid = 0;
+        for (i = 0; i < SENSOR_COUNT; i++) {
+            value = le32_to_cpu(frame->value[i]);
+            if (value != BIN_INVALID) {
+                all->value[i] = value;
+                all->valid |= BIT(i);
+            }
+        }
+        return 0;
+    case FMT_LDR_STATS:
+        if (count < LDR_STAT_COUNT)
+            break;
+        for (i = 0; i < LDR_STAT_COUNT; i++)
+            ((long *)result_ptr)[i] = (s32)le32_to_cpu(frame->value[i]);
+        return 0;
+    default:    // Um único valor, já em centésimos para FMT_CENTI
+        value = count >= 1 ? le32_to_cpu(frame->value[0]) : BIN_INVALID;
+        if (value == BIN_INVALID)
+            break;
+        if (result_ptr)
+            *(long *)result_ptr = value;
+        return desc->fmt == FMT_ACK && value != 1 ? -1 : 0;
+    }
+
+    printk(KERN_ERR "SmartLamp: Erro ao converter o quadro de resposta de %s.\n", desc->wire);
+    return -1;
+}
+
+// Converte o valor de uma resposta em texto conforme o formato do comando
+static int text_parse(const struct smartlamp_cmd_desc *desc, char *str, void *result_ptr) {
+    long value;
+
+    switch (desc->fmt) {
+    case FMT_ALL:       // Todos os sensores numa única linha: lidos de uma vez para o snapshot
+        return parse_all(str, result_ptr) ? -1 : 0;
+    case FMT_LDR_STATS:
+        return parse_ldr_stats(str, result_ptr) ? -1 : 0;
+    case FMT_AUTO:
+        return parse_auto(str, result_ptr) ? -1 : 0;
+    case FMT_ALL_TS:
+        return parse_all_ts(str, result_ptr) ? -1 : 0;
+    case FMT_DUMP:
+        return parse_dump(str, result_ptr) ? -1 : 0;
+    case FMT_CENTI:
+        if (parse_centi(str, &value))
+            return -1;
+        break;
+    default:            // FMT_INT e FMT_ACK; sscanf é mais robusto com espaços em branco
+        if (sscanf(str, "%ld", &value) != 1)
+            return -1;
+        break;
+    }
+
+    if (result_ptr)
+        *(long *)result_ptr = value;
+    return desc->fmt == FMT_ACK && value != 1 ? -1 : 0;
+}
+
+// Monta o comando em texto, "[#<tag> ]<comando>[ <argumentos>]\n": só os argumentos são formatados
+static int text_build(struct smartlamp *dev, char *buf, const struct smartlamp_cmd_desc *desc, u8 tag, const int *args) {
+    int len = 0, i;
+
+    if (dev->tagged)
+        len = scnprintf(buf, MAX_RECV_LINE, "#%u ", tag);
+    memcpy(buf + len, desc->wire, desc->wire_len);
+    len += desc->wire_len;
+    for (i = 0; i < desc->nargs; i++) {
+        if (i == 0 && desc->sensor_arg)
+            len += scnprintf(buf + len, MAX_RECV_LINE - 1 - len, " %s", sensor_table[args[0]].wire);
+        else
+            len += scnprintf(buf + len, MAX_RECV_LINE - 1 - len, " %d", args[i]);
+    }
+    buf[len++] = '\n';
+    return len;
+}
+
+// Contabiliza um comando concluído nas estatísticas do debugfs
+static void smartlamp_account(struct smartlamp *dev, enum smartlamp_cmd cmd, const struct smartlamp_xfer *xfer,
+                              int ret, u64 ns) {
+    struct smartlamp_cmd_stats *st = &dev->stats[cmd];
+    u64 us = div_u64(ns, NSEC_PER_USEC);
+    int bucket = us ? min_t(int, ilog2(us) + 1, LAT_HIST_BUCKETS - 1) : 0;
+
+    spin_lock(&dev->stats_lock);
+    st->count++;
+    if (ret)
+        st->errors++;
+    if (xfer->timeout)
+        st->timeouts++;
+    st->bytes_out += xfer->bytes_out;
+    st->bytes_in += xfer->bytes_in;
+    st->total_ns += ns;
+    st->max_ns = max(st->max_ns, ns);
+    st->hist[bucket]++;
+    spin_unlock(&dev->stats_lock);
+}
+
+// Tamanho do resultado que o formato escreve em result_ptr
+static size_t fmt_result_size(enum smartlamp_fmt fmt) {
+    switch (fmt) {
+    case FMT_ALL:
+        return sizeof(struct smartlamp_snapshot);
+    case FMT_LDR_STATS:
+        return sizeof(long) * LDR_STAT_COUNT;
+    case FMT_AUTO:
+        return sizeof(long) * AUTO_FIELD_COUNT;
+    case FMT_ALL_TS:
+        return sizeof(struct smartlamp_stamped);
+    case FMT_DUMP:
+        return sizeof(long) * DUMP_FIELD_COUNT;
+    default:
+        return sizeof(long);
+    }
+}
+
+// Entra na leitura em andamento do comando ou, se não houver, cria uma (leader verdadeiro: quem chama envia).
+// Retorna NULL sem memória; nesse caso o comando é enviado sem compartilhar o resultado.
+static struct smartlamp_flight *usb_flight_join(struct smartlamp *dev, enum smartlamp_cmd cmd, bool *leader) {
+    struct smartlamp_flight *flight;
+
+    mutex_lock(&dev->flight_mutex);
+    flight = dev->flights[cmd];
+    *leader = !flight;
+    if (flight) {
+        flight->users++;
+    } else if ((flight = kmalloc(sizeof(*flight), GFP_KERNEL))) {
+        init_completion(&flight->done);
+        flight->users = 1;
+        dev->flights[cmd] = flight;
+    }
+    mutex_unlock(&dev->flight_mutex);
+    return flight;
+}
+
+// Solta uma referência; o último a sair libera a leitura
+static void usb_flight_put(struct smartlamp *dev, struct smartlamp_flight *flight) {
+    bool last;
+
+    mutex_lock(&dev->flight_mutex);
+    last = --flight->users == 0;
+    mutex_unlock(&dev->flight_mutex);
+    if (last)
+        kfree(flight);
+}
+
+// Copia o resultado de uma leitura concluída (result_ptr só é escrito em caso de sucesso)
+static int usb_flight_result(enum smartlamp_cmd cmd, struct smartlamp_flight *flight, void *result_ptr) {
+    if (!flight->ret && result_ptr)
+        memcpy(result_ptr, &flight->result, fmt_result_size(cmd_table[cmd].fmt));
+    return flight->ret;
+}
+
+// Espera a leitura idêntica enviada por outra chamada e usa o mesmo resultado
+static int usb_flight_wait(struct smartlamp *dev, enum smartlamp_cmd cmd, struct smartlamp_flight *flight,
+                           void *result_ptr) {
+    int ret;
+
+    wait_for_completion(&flight->done);
+    ret = usb_flight_result(cmd, flight, result_ptr);
+    usb_flight_put(dev, flight);
+
+    spin_lock(&dev->stats_lock);
+    dev->stats[cmd].coalesced++;
+    spin_unlock(&dev->stats_lock);
+    return ret;
+}
+
+// Publica o resultado da leitura para quem espera. A partir daqui uma nova chamada envia outro comando.
+static int usb_flight_finish(struct smartlamp *dev, enum smartlamp_cmd cmd, struct smartlamp_flight *flight,
+                             int ret, void *result_ptr) {
+    mutex_lock(&dev->flight_mutex);
+    dev->flights[cmd] = NULL;
+    mutex_unlock(&dev->flight_mutex);
+
+    flight->ret = ret;
+    complete_all(&flight->done);
+    ret = usb_flight_result(cmd, flight, result_ptr);
+    usb_flight_put(dev, flight);
+    return ret;
+}
+
+// Envia um comando com um argumento (ou nenhum), espera e armazena a resposta
+static int usb_send_cmd(struct smartlamp *dev, enum smartlamp_cmd cmd, int param, void *result_ptr) {
+    return usb_send_cmd_args(dev, cmd, &param, result_ptr);
+}
+
+// Envia um comando com cmd_table[cmd].nargs argumentos, espera e armazena a resposta.
+// Nada é escrito no log no caminho normal: cada etapa gera um tracepoint e o comando é contabilizado no debugfs.
+// Leituras (sem argumentos e com valor na resposta) são single-flight: várias chamadas iguais ao mesmo tempo
+// (e.g., leitores concorrentes de um atributo) geram um único comando na USB e recebem o mesmo resultado.
+static int usb_send_cmd_args(struct smartlamp *dev, enum smartlamp_cmd cmd, const int *args, void *result_ptr) {
+    const struct smartlamp_cmd_desc *desc = &cmd_table[cmd];
+    struct smartlamp_flight *flight = NULL;
+    struct smartlamp_xfer xfer = {};
+    u64 start_ns = ktime_get_ns(), elapsed;
+    bool leader;
+    int ret;
+
+    if (desc->nargs == 0 && desc->fmt != FMT_ACK) {
+        flight = usb_flight_join(dev, cmd, &leader);
+        if (flight && !leader)
+            return usb_flight_wait(dev, cmd, flight, result_ptr);
+    }
+
+    ret = usb_xfer_cmd(dev, desc, args, flight ? &flight->result : result_ptr, &xfer);
+    elapsed = ktime_get_ns() - start_ns;
+
+    trace_smartlamp_cmd_done(dev->index, desc->wire, xfer.tag, ret, elapsed);
+    smartlamp_account(dev, cmd, &xfer, ret, elapsed);
+
+    if (flight)
+        ret = usb_flight_finish(dev, cmd, flight, ret, result_ptr);
+    return ret;
+}
+
+// Envia o comando, espera a resposta e a converte; preenche xfer para as estatísticas
+static int usb_xfer_cmd(struct smartlamp *dev, const struct smartlamp_cmd_desc *desc, const int *args,
+                        void *result_ptr, struct smartlamp_xfer *xfer) {
+    int ret, actual_size, cmd_len;
+    struct smartlamp_waiter waiter;
+    unsigned long flags;
+    char *out_buf;
+    u64 start_ns;
+
+    waiter.resp_expected = desc->resp;
+    waiter.resp_len = desc->resp_len;
+    waiter.line[0] = '\0';
+    waiter.bin_op = desc->bin_op;
+    waiter.slot = -1;
+    waiter.status = 0;
+    waiter.sent_ns = 0;
+    waiter.recv_ns = 0;
+    init_completion(&waiter.done);
+
+    // Ocupa uma posição na janela de comandos em andamento. O comando fica registrado antes de ser
+    // enviado, para não perder uma resposta rápida.
+    start_ns = ktime_get_ns();
+    if (!usb_claim_slot(dev, &waiter)) {
+        trace_smartlamp_cmd_retry(dev->index, desc->wire, "window", 0);
+        if (!wait_event_timeout(dev->inflight_wq, usb_claim_slot(dev, &waiter), msecs_to_jiffies(RESP_TIMEOUT))) {
+            trace_smartlamp_cmd_timeout(dev->index, desc->wire, 0, "window", ktime_get_ns() - start_ns);
+            xfer->timeout = true;
+            printk_ratelimited(KERN_ERR "SmartLamp: Timeout - janela de comandos cheia\n");
+            return -ETIMEDOUT;
+        }
+    }
+    if (waiter.slot < 0)
+        return -ENODEV;
+
+    // A tag vai no campo seq do quadro binário ou como prefixo "#<tag> " do comando em texto
+    out_buf = dev->out_buf[waiter.slot];
+    waiter.binary = dev->use_binary && desc->bin_op != BIN_OP_NONE;
+    if (waiter.binary) {
+        bin_build((struct smartlamp_frame *)out_buf, desc->bin_op, waiter.tag, args, desc->nargs);
+        cmd_len = BIN_FRAME_SIZE;
+    } else {
+        cmd_len = text_build(dev, out_buf, desc, waiter.tag, args);
+    }
+    xfer->tag = waiter.tag;
+    xfer->bytes_out = cmd_len;
+
+    // Envia o comando para o dispositivo USB
+    waiter.sent_ns = ktime_get_ns();
+    trace_smartlamp_cmd_submit(dev->index, desc->wire, waiter.tag, waiter.binary, cmd_len, waiter.sent_ns - start_ns);
+    ret = usb_bulk_msg(dev->udev, usb_sndbulkpipe(dev->udev, dev->usb_out),
+                       out_buf, cmd_len, &actual_size, 1000);
+    if (!ret && actual_size != cmd_len)
+        ret = -EIO;     // Comando truncado: o firmware não responderia, não adianta esperar RESP_TIMEOUT
+    if (ret) {
+        printk_ratelimited(KERN_ERR "SmartLamp: Erro de codigo %d ao enviar comando!\n", ret);
+    } else if (!wait_for_completion_timeout(&waiter.done, msecs_to_jiffies(RESP_TIMEOUT))) {
+        // Espera a resposta, que é entregue pelo callback das URBs de leitura
+        trace_smartlamp_cmd_timeout(dev->index, desc->wire, waiter.tag, "response", ktime_get_ns() - waiter.sent_ns);
+        xfer->timeout = true;
+        printk_ratelimited(KERN_ERR "SmartLamp: Timeout - não recebeu resposta esperada (%s)\n", desc->wire);
+        ret = -ETIMEDOUT;
+    }
+
+    // Libera a posição na janela: garante que o callback não acessa mais o waiter (que está na pilha)
+    spin_lock_irqsave(&dev->recv_lock, flags);
+    if (waiter.slot >= 0) {
+        dev->inflight[waiter.slot] = NULL;
+        dev->inflight_count--;
+        waiter.slot = -1;
+        wake_up(&dev->inflight_wq);
+    }
+    spin_unlock_irqrestore(&dev->recv_lock, flags);
+
+    if (ret)
+        return ret;
+    if (waiter.status)
+        return waiter.status;
+
+    xfer->bytes_in = waiter.binary ? BIN_FRAME_SIZE : strlen(waiter.line) + 1;
+    // Daqui em diante o dispositivo respondeu: recusa ou resposta inválida é -EINVAL (timeout e
+    // desconexão têm códigos próprios, para quem chama distinguir firmware antigo de lâmpada parada)
+    if (waiter.binary)
+        return bin_parse(desc, &waiter.frame, result_ptr) ? -EINVAL : 0;
+
+    if (strncmp(waiter.line, "ERR", 3) == 0) {
+        printk(KERN_ERR "SmartLamp: Comando %s recusado pelo dispositivo: %s\n", desc->wire, waiter.line);
+        return -EINVAL;
+    }
+    if (text_parse(desc, skip_spaces(waiter.line + waiter.resp_len), result_ptr) == 0) {
+        // O par envio/chegada acompanha a resposta para a correlação dos relógios
+        if (desc->fmt == FMT_ALL_TS && result_ptr) {
+            ((struct smartlamp_stamped *)result_ptr)->sent_ns = waiter.sent_ns;
+            ((struct smartlamp_stamped *)result_ptr)->recv_ns = waiter.recv_ns;
+        }
+        return 0;
+    }
+
+    printk(KERN_ERR "SmartLamp: Erro ao converter a resposta de %s: %s\n", desc->wire, waiter.line);
+    return -EINVAL;
+}
+
+// ---
+
+// Lê todos os sensores e publica os valores no snapshot.
+// Sensores que falharem ficam marcados como inválidos até a próxima atualização.
+static int smartlamp_refresh(struct smartlamp *dev) {
+    struct smartlamp_stamped stamped;
+    struct smartlamp_snapshot *all = &stamped.all;
+    int i, ret = -EINVAL;
+    u64 now;
+
+    // Com GET_ALL_TS (ou GET_ALL) todos os sensores vêm numa única resposta; GET_ALL_TS informa também
+    // quando o ESP32 amostrou cada um. Sem ele, as amostras são datadas pela chegada da resposta.
+    // Só desce para o comando seguinte se o firmware recusou (-EINVAL): com a lâmpada sem responder cada
+    // tentativa esperaria RESP_TIMEOUT com refresh_mutex adquirido, segurando os leitores do sysfs.
+    all->valid = 0;
+    if (dev->has_get_all_ts)
+        ret = usb_send_cmd(dev, CMD_GET_ALL_TS, 0, &stamped);
+    if (ret == 0) {
+        smartlamp_clock_stamp(dev, &stamped);
+    } else {
+        if (ret == -EINVAL && dev->has_get_all)
+            ret = usb_send_cmd(dev, CMD_GET_ALL, 0, all);
+        if (ret == -EINVAL) {
+            for (i = 0; i < SENSOR_COUNT; i++) {
+                ret = usb_send_cmd(dev, sensor_table[i].get, 0, &all->value[i]);
+                if (ret == 0)
+                    all->valid |= BIT(i);
+                else if (ret != -EINVAL)
+                    break;
+            }
+        }
+        now = ktime_get_ns();
+        for (i = 0; i < SENSOR_COUNT; i++)
+            all->time_ns[i] = now;
+    }
+
+    write_seqlock(&dev->snapshot_lock);
+    for (i = 0; i < SENSOR_COUNT; i++) {
+        if (all->valid & BIT(i)) {
+            dev->snapshot.value[i] = all->value[i];
+            dev->snapshot.time_ns[i] = all->time_ns[i];
+        }
+    }
+    dev->snapshot.valid = all->valid;
+    dev->snapshot.stamp = jiffies ?: 1;      // stamp 0 indica snapshot nunca preenchido
+    write_sequnlock(&dev->snapshot_lock);
+
+    smartlamp_push_sample(dev, all);
+
+    // Falha também fica registrada no snapshot (stamp), então os leitores só tentam de novo após max_age_ms
+    return all->valid ? 0 : (ret ?: -EIO);
+}
+
+// Amostrador em segundo plano: atualiza o snapshot e se reagenda conforme sample_period_ms
+static void sampler_work_fn(struct work_struct *work) {
+    struct smartlamp *dev = container_of(to_delayed_work(work), struct smartlamp, sampler_work);
+    unsigned int period = READ_ONCE(sample_period_ms);
+
+    if (!READ_ONCE(dev->sampler_running) || !period)
+        return;
+
+    mutex_lock(&dev->refresh_mutex);
+    smartlamp_refresh(dev);
+    mutex_unlock(&dev->refresh_mutex);
+
+    if (READ_ONCE(dev->sampler_running))
+        schedule_delayed_work(&dev->sampler_work, msecs_to_jiffies(period));
+}
+
+// Alteração de sample_period_ms: reagenda os amostradores para o novo período ter efeito imediato
+static int sample_period_set(const char *val, const struct kernel_param *kp) {
+    struct smartlamp *dev;
+    int ret = param_set_uint(val, kp);
+
+    if (ret)
+        return ret;
+
+    mutex_lock(&smartlamp_list_lock);
+    list_for_each_entry(dev, &smartlamp_list, node)
+        if (READ_ONCE(dev->sampler_running))
+            mod_delayed_work(system_wq, &dev->sampler_work, 0);
+    mutex_unlock(&smartlamp_list_lock);
+    return 0;
+}
+
+// Lê um sensor do snapshot sem bloquear.
+// Retorna 0 se o valor é válido, -EIO se a última leitura do sensor falhou e -ESTALE se o snapshot
+// é mais velho que max_age_ms.
+static int snapshot_read(struct smartlamp *dev, enum smartlamp_sensor sensor, long *value) {
+    unsigned int seq;
+    unsigned long stamp, valid;
+
+    do {
+        seq = read_seqbegin(&dev->snapshot_lock);
+        *value = dev->snapshot.value[sensor];
+        valid = dev->snapshot.valid;
+        stamp = dev->snapshot.stamp;
+    } while (read_seqretry(&dev->snapshot_lock, seq));
+
+    if (!stamp || time_after(jiffies, stamp + msecs_to_jiffies(READ_ONCE(max_age_ms))))
+        return -ESTALE;
+    return (valid & BIT(sensor)) ? 0 : -EIO;
+}
+
+// Obtém o valor de um sensor: do snapshot se estiver atualizado, senão força uma leitura síncrona
+static int snapshot_get(struct smartlamp *dev, enum smartlamp_sensor sensor, long *value) {
+    int ret = snapshot_read(dev, sensor, value);
+
+    if (ret != -ESTALE)
+        return ret;
+
+    // Apenas um leitor atualiza; os demais esperam e aproveitam o resultado
+    mutex_lock(&dev->refresh_mutex);
+    if (snapshot_read(dev, sensor, value) == -ESTALE)
+        smartlamp_refresh(dev);
+    mutex_unlock(&dev->refresh_mutex);
+
+    ret = snapshot_read(dev, sensor, value);
+    return ret == -ESTALE ? -EIO : ret;
+}
+
+// Preenche o cabeçalho do anel mapeável (memória já zerada pelo vmalloc_user)
+static void smartlamp_ring_init(struct smartlamp_ring_header *hdr) {
+    hdr->magic = SMARTLAMP_RING_MAGIC;
+    hdr->version = SMARTLAMP_RING_VERSION;
+    hdr->entries = RING_ENTRIES;
+    hdr->entry_size = sizeof(struct smartlamp_sample);
+    hdr->data_offset = PAGE_SIZE;
+}
+
+// Publica uma amostra no anel mapeável, seguindo a ordem descrita em smartlamp_uapi.h.
+// Chamada com readers_lock adquirido: só existe um produtor por vez, então head e tail são lidos sem barreira.
+static void smartlamp_ring_push(struct smartlamp *dev, const struct smartlamp_sample *sample) {
+    struct smartlamp_ring_header *hdr = dev->ring;
+    struct smartlamp_sample *data = dev->ring + PAGE_SIZE;
+    u64 head = hdr->head;
+
+    // Anel cheio: avisa que a entrada mais antiga deixa de ser válida antes de sobrescrevê-la
+    if (head - hdr->tail >= RING_ENTRIES) {
+        WRITE_ONCE(hdr->tail, head + 1 - RING_ENTRIES);
+        smp_wmb();
+    }
+
+    data[head & (RING_ENTRIES - 1)] = *sample;
+    smp_store_release(&hdr->head, head + 1);  // A entrada fica visível antes do novo head
+}
+
+static void sample_set_value(struct smartlamp_sample *sample, enum smartlamp_sensor sensor, long value) {
+    *(s32 *)((u8 *)sample + sensor_table[sensor].sample_offset) = value;
+}
+
+static long sample_get_value(const struct smartlamp_sample *sample, enum smartlamp_sensor sensor) {
+    return *(const s32 *)((const u8 *)sample + sensor_table[sensor].sample_offset);
+}
+
+// Numera a amostra e a publica no anel mapeável e na fila de cada leitor de /dev/smartlampN.
+// Chamada tanto pelo amostrador quanto pelo callback das URBs (modo STREAM); readers_lock serializa os dois.
+static void smartlamp_publish_sample(struct smartlamp *dev, struct smartlamp_sample *sample) {
+    struct smartlamp_reader *reader;
+    unsigned long flags;
+
+    spin_lock_irqsave(&dev->readers_lock, flags);
+    sample->seq = dev->sample_seq++;
+    smartlamp_ring_push(dev, sample);
+    if ((sample->valid & SMARTLAMP_SAMPLE_LOG) && dev->log_replay)
+        dev->log_replay[dev->log_replayed++ % LOG_REPLAY_LEN] = *sample;
+
+    // Fila cheia: a amostra é descartada para esse leitor, que percebe o salto em seq
+    list_for_each_entry(reader, &dev->readers, node)
+        kfifo_put(&reader->fifo, *sample);
+    smartlamp_iio_update(dev, sample);
+    spin_unlock_irqrestore(&dev->readers_lock, flags);
+
+    wake_up_interruptible(&dev->read_wq);
+}
+
+// Converte uma leitura do amostrador para o registro de /dev/smartlampN e a publica.
+// O registro leva um único instante: o do LDR, o sensor amostrado continuamente, ou o mais antigo dos válidos.
+static void smartlamp_push_sample(struct smartlamp *dev, const struct smartlamp_snapshot *all) {
+    struct smartlamp_sample sample;
+    int i;
+
+    if (!all->valid)
+        return;
+
+    memset(&sample, 0, sizeof(sample));
+    if (all->valid & BIT(SENSOR_LDR)) {
+        sample.timestamp_ns = all->time_ns[SENSOR_LDR];
+    } else {
+        sample.timestamp_ns = U64_MAX;
+        for (i = 0; i < SENSOR_COUNT; i++)
+            if (all->valid & BIT(i))
+                sample.timestamp_ns = min(sample.timestamp_ns, all->time_ns[i]);
+    }
+    sample.valid = all->valid;
+    for (i = 0; i < SENSOR_COUNT; i++)
+        sample_set_value(&sample, i, all->value[i]);
+    smartlamp_publish_sample(dev, &sample);
+}
+
+// Atualiza um valor no snapshot (e.g., após um SET_LED confirmado)
+static void snapshot_set(struct smartlamp *dev, enum smartlamp_sensor sensor, long value) {
+    write_seqlock(&dev->snapshot_lock);
+    dev->snapshot.value[sensor] = value;
+    dev->snapshot.time_ns[sensor] = ktime_get_ns();
+    dev->snapshot.valid |= BIT(sensor);
+    write_sequnlock(&dev->snapshot_lock);
+}
+
+// ---
+
+// Recuperação dos registros do firmware. Um "DUMP 0 0 0" informa o boot; se o driver já viu esse boot antes
+// (desconexão e reconexão sem o ESP32 reiniciar), pede só os registros posteriores à última amostra ao vivo,
+// senão pede todos. Os registros chegam pelo fluxo de amostras (usb_log_frame) com SMARTLAMP_SAMPLE_LOG e
+// também ficam guardados em log_replay para os leitores que abrirem /dev/smartlampN depois.
+// Cada DUMP é limitado ao que a serial transmite em metade de RESP_TIMEOUT; o último vem incompleto.
+static void smartlamp_backfill(struct smartlamp *dev) {
+    struct smartlamp_sample *replay;
+    long fields[DUMP_FIELD_COUNT];
+    int args[3] = { 0, 0, 0 };
+    u32 records;
+    int i, per_dump;
+
+    if (usb_send_cmd_args(dev, CMD_DUMP, args, fields) != 0) {
+        printk(KERN_INFO "SmartLamp: DUMP nao suportado, amostras da desconexao nao recuperadas\n");
+        return;
+    }
+
+    // Sem memória os registros ainda chegam a quem já está lendo, só não são repetidos para os próximos
+    replay = kmalloc_array(LOG_REPLAY_LEN, sizeof(*replay), GFP_KERNEL);
+    spin_lock_irq(&dev->readers_lock);
+    dev->log_replay = replay;
+    spin_unlock_irq(&dev->readers_lock);
+
+    mutex_lock(&log_resume_lock);
+    for (i = 0; i < LOG_RESUME_SLOTS; i++) {
+        if (log_resume[i].boot == (u32)fields[DUMP_BOOT]) {
+            args[0] = log_resume[i].next;
+            // O firmware aceita até 9 dígitos; bem antes disso o anel dele já foi sobrescrito
+            if (log_resume[i].live_ns)
+                args[2] = clamp_t(u64, div_u64(ktime_get_ns() - log_resume[i].live_ns, NSEC_PER_MSEC), 1, 999999999);
+        }
+    }
+    mutex_unlock(&log_resume_lock);
+
+    // Registros de BIN_FRAME_SIZE bytes a 10 bits por byte
+    per_dump = clamp_t(int, dev->baud / 10 * (RESP_TIMEOUT / 2) / 1000 / BIN_FRAME_SIZE, 1, 1024);
+    args[1] = per_dump;
+
+    spin_lock_irq(&dev->recv_lock);
+    records = dev->log_records;
+    spin_unlock_irq(&dev->recv_lock);
+
+    do {
+        if (usb_send_cmd_args(dev, CMD_DUMP, args, fields) != 0) {
+            printk(KERN_ERR "SmartLamp: falha ao recuperar o registro do firmware\n");
+            return;
+        }
+        args[0] = fields[DUMP_NEXT];
+    } while (fields[DUMP_SENT] == per_dump);
+
+    dev->log_boot = fields[DUMP_BOOT];
+    dev->log_next = fields[DUMP_NEXT];
+
+    spin_lock_irq(&dev->recv_lock);
+    records = dev->log_records - records;
+    spin_unlock_irq(&dev->recv_lock);
+    printk(KERN_INFO "SmartLamp: %u amostras recuperadas do registro do firmware\n", records);
+}
+
+// Recupera os registros e só então inicia o amostrador. refresh_mutex fica adquirido durante a recuperação:
+// nenhuma leitura ao vivo (amostrador, sysfs ou configfs) é publicada no meio dos registros antigos.
+static void smartlamp_backfill_work_fn(struct work_struct *work) {
+    struct smartlamp *dev = container_of(work, struct smartlamp, backfill_work);
+
+    mutex_lock(&dev->refresh_mutex);
+    smartlamp_backfill(dev);
+    mutex_unlock(&dev->refresh_mutex);
+
+    if (READ_ONCE(dev->sampler_running))
+        schedule_delayed_work(&dev->sampler_work, 0);
+}
+
+// Guarda o boot do firmware, o próximo registro e o instante da última amostra ao vivo. Sem DUMP não há o que
+// guardar. Ocupa a posição do mesmo boot, uma livre ou a mais antiga.
+static void smartlamp_log_save(struct smartlamp *dev) {
+    struct smartlamp_log_resume *slot = &log_resume[0];
+    u64 live_ns;
+    unsigned int seq;
+    int i;
+
+    if (!dev->log_boot)
+        return;
+
+    do {
+        seq = read_seqbegin(&dev->snapshot_lock);
+        live_ns = 0;
+        for (i = 0; i < SENSOR_COUNT; i++)
+            if (dev->snapshot.valid & BIT(i))
+                live_ns = max(live_ns, dev->snapshot.time_ns[i]);
+    } while (read_seqretry(&dev->snapshot_lock, seq));
+
+    mutex_lock(&log_resume_lock);
+    for (i = 0; i < LOG_RESUME_SLOTS; i++) {
+        if (log_resume[i].boot == dev->log_boot) {
+            slot = &log_resume[i];
+            break;
+        }
+        if (slot->boot && (!log_resume[i].boot || log_resume[i].live_ns < slot->live_ns))
+            slot = &log_resume[i];
+    }
+    slot->boot = dev->log_boot;
+    slot->next = dev->log_next;
+    slot->live_ns = live_ns;
+    mutex_unlock(&log_resume_lock);
+}
+
+// ---
+
+// Estende um instante de 32 bits do ESP32 para 64 bits, em torno do último recebido (até ~35 min antes ou depois)
+static u64 clock_extend(const struct smartlamp_clock *c, u32 us) {
+    return c->dev_us + (s32)(us - (u32)c->dev_us);
+}
+
+// Converte um instante do ESP32 para o CLOCK_MONOTONIC do host
+static u64 clock_to_host(const struct smartlamp_clock *c, u64 dev_us) {
+    s64 elapsed = (s64)(dev_us - c->ref_dev_us) * NSEC_PER_USEC;
+
+    return c->ref_host_ns + elapsed + div_s64(elapsed * c->drift_ppb, NSEC_PER_SEC);
+}
+
+// Acrescenta um par envio/resposta à correlação. Retorna verdadeiro se o par corrigiu a referência.
+// Chamada com clock_lock adquirido.
+static bool clock_sync(struct smartlamp_clock *c, u64 sent_ns, u64 recv_ns, u32 now_us) {
+    u64 rtt = recv_ns - sent_ns, mid = sent_ns + rtt / 2, dev_us = 0;
+    s64 residual = 0, base;
+    bool used = false;
+
+    if (c->samples) {
+        dev_us = clock_extend(c, now_us);
+        residual = mid - clock_to_host(c, dev_us);
+        if (abs(residual) > CLOCK_RESYNC_NS)
+            c->samples = 0;
+    }
+
+    if (!c->samples) {
+        memset(c, 0, sizeof(*c));
+        c->dev_us = c->ref_dev_us = c->anchor_dev_us = now_us;
+        c->ref_host_ns = c->anchor_host_ns = mid;
+        c->rtt_min_ns = c->rtt_avg_ns = rtt;
+        residual = 0;
+        used = true;
+    } else {
+        c->dev_us = dev_us;
+        c->rtt_min_ns = min(c->rtt_min_ns, rtt);
+        c->rtt_avg_ns += div_s64((s64)rtt - (s64)c->rtt_avg_ns, 8);
+        c->jitter_ns += div_s64(abs(residual) - (s64)c->jitter_ns, 16);
+
+        // A correção é suavizada: um par isolado não move a referência mais que 1/8 do seu desvio
+        if (rtt <= c->rtt_min_ns + c->rtt_min_ns / 2 + CLOCK_RTT_SLACK_NS) {
+            c->ref_host_ns = clock_to_host(c, dev_us) + div_s64(residual, 8);
+            c->ref_dev_us = dev_us;
+            base = (dev_us - c->anchor_dev_us) * NSEC_PER_USEC;
+            if (base >= CLOCK_DRIFT_MIN_NS)
+                c->drift_ppb = div64_s64(((s64)(c->ref_host_ns - c->anchor_host_ns) - base) * NSEC_PER_SEC, base);
+            if (base >= CLOCK_DRIFT_MAX_NS) {
+                c->anchor_dev_us = c->ref_dev_us;
+                c->anchor_host_ns = c->ref_host_ns;
+            }
+            used = true;
+        }
+    }
+
+    c->rtt_ns = rtt;
+    c->residual_ns = residual;
+    c->last_recv_ns = recv_ns;
+    c->samples++;
+    return used;
+}
+
+// Correlaciona os relógios com o par de GET_ALL_TS e converte os instantes das amostras para o host.
+// O LED é o valor atual, então a amostra dele é o instante da resposta.
+static void smartlamp_clock_stamp(struct smartlamp *dev, struct smartlamp_stamped *st) {
+    struct smartlamp_clock *c = &dev->clock;
+    u64 *time_ns = st->all.time_ns;
+    s64 residual, drift;
+    unsigned long flags;
+    u64 rtt;
+    bool synced = false, used = false;
+
+    // Leituras agrupadas numa só (usb_flight_join) recebem o mesmo par: ele só entra uma vez na correlação
+    spin_lock_irqsave(&dev->clock_lock, flags);
+    if (!c->samples || st->recv_ns != c->last_recv_ns) {
+        used = clock_sync(c, st->sent_ns, st->recv_ns, st->now_us);
+        synced = true;
+    }
+    time_ns[SENSOR_LED] = clock_to_host(c, clock_extend(c, st->now_us));
+    time_ns[SENSOR_LDR] = clock_to_host(c, clock_extend(c, st->ldr_us));
+    time_ns[SENSOR_TEMP] = time_ns[SENSOR_HUM] = clock_to_host(c, clock_extend(c, st->dht_us));
+    rtt = c->rtt_ns;
+    residual = c->residual_ns;
+    drift = c->drift_ppb;
+    spin_unlock_irqrestore(&dev->clock_lock, flags);
+
+    if (synced)
+        trace_smartlamp_clock_sync(dev->index, rtt, residual, drift, used);
+}
+
+// Converte um micros() do ESP32 (e.g., de uma linha STR) para o CLOCK_MONOTONIC.
+// Retorna falso antes da primeira correlação. Pode ser chamada em contexto de interrupção.
+static bool smartlamp_clock_convert(struct smartlamp *dev, u32 us, u64 *ns) {
+    struct smartlamp_clock *c = &dev->clock;
+    unsigned long flags;
+    bool ok;
+
+    spin_lock_irqsave(&dev->clock_lock, flags);
+    ok = c->samples != 0;
+    if (ok)
+        *ns = clock_to_host(c, clock_extend(c, us));
+    spin_unlock_irqrestore(&dev->clock_lock, flags);
+    return ok;
+}
+
+// ---
+
+// Escreve um valor no formato do sensor; FMT_CENTI sai com duas casas decimais (e.g., 2530 -> "25.30", -150 -> "-1.50")
+static int format_value(char *buff, int at, enum smartlamp_fmt fmt, long value) {
+    if (fmt != FMT_CENTI)
+        return sysfs_emit_at(buff, at, "%ld", value);
+    return sysfs_emit_at(buff, at, "%s%ld.%02ld", value < 0 ? "-" : "", abs(value) / 100, abs(value) % 100);
+}
+
+// Executado quando o arquivo /sys/kernel/smartlamp/lampN/{led, ldr, temp, hum} é lido (e.g., cat /sys/kernel/smartlamp/lamp0/led)
+static ssize_t attr_show(struct kobject *sys_obj, struct kobj_attribute *attr, char *buff) {
+    struct smartlamp *dev = to_smartlamp(sys_obj);
+    enum smartlamp_sensor sensor = to_sensor_attr(attr)->sensor;
+    long value;
+    int len;
+
+    // Lê o valor do snapshot (só acessa a USB se ele estiver desatualizado)
+    if (snapshot_get(dev, sensor, &value) < 0) {
+        printk(KERN_ERR "SmartLamp: Erro ao ler %s\n", sensor_table[sensor].name);
+        return -EIO;
+    }
+
+    len = format_value(buff, 0, sensor_table[sensor].fmt, value);
+    return len + sysfs_emit_at(buff, len, "\n");
+}
+
+// ---
+
+// Executado quando o arquivo /sys/kernel/smartlamp/lampN/{led} é escrito (e.g., echo "100" | sudo tee -a /sys/kernel/smartlamp/lamp0/led).
+// Só existe para os sensores com comando de escrita em sensor_table.
+static ssize_t attr_store(struct kobject *sys_obj, struct kobj_attribute *attr, const char *buff, size_t count) {
+    struct smartlamp *dev = to_smartlamp(sys_obj);
+    enum smartlamp_sensor sensor = to_sensor_attr(attr)->sensor;
+    const struct smartlamp_sensor_desc *desc = &sensor_table[sensor];
+    long value;
+    int ret;
+
+    // Converte o valor recebido da string para long, no formato do sensor
+    if (desc->fmt == FMT_CENTI ? parse_centi(buff, &value) : sscanf(buff, "%ld", &value) != 1) {
+        printk(KERN_ALERT "SmartLamp: valor de %s invalido.\n", desc->name);
+        return -EACCES;
+    }
+
+    ret = smartlamp_write(dev, sensor, value);
+    return ret ? ret : count;
+}
+
+// ---
+
+// Interface exportada em smartlamp.h, usada pelo smartlamp-configfs.ko
+
+// Procura a lâmpada lampN e segura uma referência ao kobject: a estrutura continua válida mesmo que a
+// lâmpada seja desconectada antes do smartlamp_put (os comandos passam a falhar com -ENODEV)
+struct smartlamp *smartlamp_get(int index) {
+    struct smartlamp *dev, *found = NULL;
+
+    mutex_lock(&smartlamp_list_lock);
+    list_for_each_entry(dev, &smartlamp_list, node) {
+        if (dev->index == index) {
+            found = to_smartlamp(kobject_get(&dev->kobj));
+            break;
+        }
+    }
+    mutex_unlock(&smartlamp_list_lock);
+    return found;
+}
+EXPORT_SYMBOL_GPL(smartlamp_get);
+
+void smartlamp_put(struct smartlamp *dev) {
+    kobject_put(&dev->kobj);
+}
+EXPORT_SYMBOL_GPL(smartlamp_put);
+
+// Lê o sensor no dispositivo (sem passar pelo snapshot) e aproveita o valor para atualizar o snapshot
+int smartlamp_read(struct smartlamp *dev, enum smartlamp_sensor sensor, long *value) {
+    int ret;
+
+    if ((unsigned int)sensor >= SENSOR_COUNT)
+        return -EINVAL;
+
+    ret = usb_send_cmd(dev, sensor_table[sensor].get, 0, value);
+    if (ret < 0)
+        return ret == -ENODEV ? -ENODEV : -EIO;
+
+    snapshot_set(dev, sensor, *value);
+    return 0;
+}
+EXPORT_SYMBOL_GPL(smartlamp_read);
+
+// Lê todos os sensores numa única transação (GET_ALL_TS ou GET_ALL, como o amostrador) e atualiza o snapshot.
+// value tem SENSOR_COUNT posições; valid recebe um bit (BIT(sensor)) por sensor lido com sucesso.
+int smartlamp_read_all(struct smartlamp *dev, long *value, unsigned long *valid) {
+    unsigned int seq;
+    int ret, i;
+
+    mutex_lock(&dev->refresh_mutex);
+    ret = smartlamp_refresh(dev);
+    do {
+        seq = read_seqbegin(&dev->snapshot_lock);
+        for (i = 0; i < SENSOR_COUNT; i++)
+            value[i] = dev->snapshot.value[i];
+        *valid = dev->snapshot.valid;
+    } while (read_seqretry(&dev->snapshot_lock, seq));
+    mutex_unlock(&dev->refresh_mutex);
+
+    if (ret < 0)
+        return ret == -ENODEV ? -ENODEV : -EIO;
+    return 0;
+}
+EXPORT_SYMBOL_GPL(smartlamp_read_all);
+
+// Escreve no sensor, conferindo a faixa de sensor_table. Usada também pelo attr_store.
+int smartlamp_write(struct smartlamp *dev, enum smartlamp_sensor sensor, long value) {
+    const struct smartlamp_sensor_desc *desc;
+    int ret;
+
+    if ((unsigned int)sensor >= SENSOR_COUNT || sensor_table[sensor].set < 0)
+        return -EINVAL;
+    desc = &sensor_table[sensor];
+
+    if (value < desc->min || value > desc->max) {
+        printk(KERN_ALERT "SmartLamp: valor de %s deve estar entre %ld e %ld.\n", desc->name, desc->min, desc->max);
+        return -EINVAL;
+    }
+
+    // O LED passa por smartlamp_set_led para ficar em ordem com o LED class
+    if (sensor == SENSOR_LED)
+        ret = smartlamp_set_led(dev, value);
+    else if ((ret = usb_send_cmd(dev, desc->set, (int)value, NULL)) == 0)
+        snapshot_set(dev, sensor, value);
+    if (ret < 0) {
+        printk(KERN_ALERT "SmartLamp: erro ao setar o valor do %s.\n", desc->name);
+        return -EIO;
+    }
+
+    return 0;
+}
+EXPORT_SYMBOL_GPL(smartlamp_write);
+
+// Escreve o valor no formato do sensor. buf deve ser a página de um show (sysfs ou configfs).
+int smartlamp_format(char *buf, enum smartlamp_sensor sensor, long value) {
+    if ((unsigned int)sensor >= SENSOR_COUNT)
+        return -EINVAL;
+    return format_value(buf, 0, sensor_table[sensor].fmt, value);
+}
+EXPORT_SYMBOL_GPL(smartlamp_format);
+
+// Executado quando /sys/kernel/smartlamp/lampN/baud é lido: velocidade negociada no probe
+static ssize_t baud_show(struct kobject *sys_obj, struct kobj_attribute *attr, char *buff) {
+    return sprintf(buff, "%u\n", to_smartlamp(sys_obj)->baud);
+}
+
+// Executado quando /sys/kernel/smartlamp/lampN/stream é lido: "<sensor> <Hz>" ou "off"
+static ssize_t stream_show(struct kobject *sys_obj, struct kobj_attribute *attr, char *buff) {
+    struct smartlamp *dev = to_smartlamp(sys_obj);
+    int sensor = READ_ONCE(dev->stream_sensor);
+
+    if (sensor < 0)
+        return sprintf(buff, "off\n");
+    return sprintf(buff, "%s %u\n", sensor_table[sensor].name, READ_ONCE(dev->stream_rate));
+}
+
+// Executado quando /sys/kernel/smartlamp/lampN/stream é escrito:
+// "ldr 100" pede ao firmware uma amostra do LDR a cada 10 ms, "off" (ou "0") desliga o fluxo.
+// As amostras chegam em /dev/smartlampN com a flag SMARTLAMP_SAMPLE_STREAM.
+static ssize_t stream_store(struct kobject *sys_obj, struct kobj_attribute *attr, const char *buff, size_t count) {
+    struct smartlamp *dev = to_smartlamp(sys_obj);
+    char name[8];
+    unsigned int rate;
+    int sensor;
+
+    if (sysfs_streq(buff, "off") || sysfs_streq(buff, "0")) {
+        if (usb_send_cmd(dev, CMD_STOP, 0, NULL) < 0) {
+            printk(KERN_ALERT "SmartLamp: erro ao desligar o modo STREAM.\n");
+            return -EIO;
+        }
+        WRITE_ONCE(dev->stream_sensor, -1);
+        WRITE_ONCE(dev->stream_rate, 0);
+        return count;
+    }
+
+    if (sscanf(buff, "%7s %u", name, &rate) != 2 || rate == 0) {
+        printk(KERN_ALERT "SmartLamp: use \"<sensor> <Hz>\" ou \"off\".\n");
+        return -EINVAL;
+    }
+    for (sensor = 0; sensor < SENSOR_COUNT && strcmp(name, sensor_table[sensor].name) != 0; sensor++)
+        ;
+    if (sensor == SENSOR_COUNT) {
+        printk(KERN_ALERT "SmartLamp: sensor desconhecido: %s\n", name);
+        return -EINVAL;
+    }
+
+    if (rate > INT_MAX || usb_send_cmd_args(dev, CMD_STREAM, (int[]){ sensor, rate }, NULL) < 0) {
+        printk(KERN_ALERT "SmartLamp: firmware recusou o modo STREAM (%s %u Hz).\n", name, rate);
+        return -EIO;
+    }
+    WRITE_ONCE(dev->stream_rate, rate);
+    WRITE_ONCE(dev->stream_sensor, sensor);
+    return count;
+}
+
+// Executado quando /sys/kernel/smartlamp/lampN/ldr_stats é lido: média, mínimo, máximo e variância
+// da última janela de amostras do LDR, calculados no firmware (sempre consulta o dispositivo)
+static ssize_t ldr_stats_show(struct kobject *sys_obj, struct kobj_attribute *attr, char *buff) {
+    struct smartlamp *dev = to_smartlamp(sys_obj);
+    long stats[LDR_STAT_COUNT];
+    int i, len = 0;
+
+    if (usb_send_cmd(dev, CMD_GET_LDR_STATS, 0, stats) < 0) {
+        printk(KERN_ERR "SmartLamp: Erro ao ler ldr_stats\n");
+        return -EIO;
+    }
+
+    for (i = 0; i < LDR_STAT_COUNT; i++) {
+        if (i)
+            len += sysfs_emit_at(buff, len, " ");
+        len += format_value(buff, len, FMT_CENTI, stats[i]);
+    }
+    len += sysfs_emit_at(buff, len, "\n");
+    return len;
+}
+
+static ssize_t ldr_window_show(struct kobject *sys_obj, struct kobj_attribute *attr, char *buff) {
+    return sprintf(buff, "%u\n", READ_ONCE(to_smartlamp(sys_obj)->ldr_window));
+}
+
+// Executado quando /sys/kernel/smartlamp/lampN/ldr_window é escrito: amostras por janela (1 ms cada)
+static ssize_t ldr_window_store(struct kobject *sys_obj, struct kobj_attribute *attr, const char *buff, size_t count) {
+    struct smartlamp *dev = to_smartlamp(sys_obj);
+    unsigned int window;
+
+    if (kstrtouint(buff, 10, &window) || window == 0 || window > INT_MAX) {
+        printk(KERN_ALERT "SmartLamp: valor de ldr_window invalido.\n");
+        return -EINVAL;
+    }
+
+    if (usb_send_cmd(dev, CMD_SET_LDR_WINDOW, window, NULL) < 0) {
+        printk(KERN_ALERT "SmartLamp: firmware recusou a janela de %u amostras.\n", window);
+        return -EIO;
+    }
+    WRITE_ONCE(dev->ldr_window, window);
+    return count;
+}
+
+// Executado quando /sys/kernel/smartlamp/lampN/led_ramp é escrito: "<destino> <ms> [gamma|linear]".
+// O firmware faz a transição a partir do brilho atual (e.g., "80 1000" leva o LED a 80 em 1 s).
+static ssize_t led_ramp_store(struct kobject *sys_obj, struct kobj_attribute *attr, const char *buff, size_t count) {
+    static const char * const curves[] = { "linear", "gamma" };   // Mesma numeração do firmware
+    struct smartlamp *dev = to_smartlamp(sys_obj);
+    unsigned int target, ms;
+    char curve[8] = "gamma";
+    int shape;
+
+    if (sscanf(buff, "%u %u %7s", &target, &ms, curve) < 2 ||
+        target > sensor_table[SENSOR_LED].max || ms > LED_RAMP_MAX_MS) {
+        printk(KERN_ALERT "SmartLamp: use \"<destino 0-100> <ms ate %d> [gamma|linear]\".\n", LED_RAMP_MAX_MS);
+        return -EINVAL;
+    }
+    shape = match_string(curves, ARRAY_SIZE(curves), curve);
+    if (shape < 0) {
+        printk(KERN_ALERT "SmartLamp: curva desconhecida: %s\n", curve);
+        return -EINVAL;
+    }
+
+    if (smartlamp_led_ramp(dev, target, ms, shape) < 0) {
+        printk(KERN_ALERT "SmartLamp: firmware recusou a transicao do LED.\n");
+        return -EIO;
+    }
+    return count;
+}
+
+// Executado quando /sys/kernel/smartlamp/lampN/auto é lido ou escrito: 1 com o controle automático da
+// luminosidade ligado no firmware. Enquanto ligado, o próprio firmware ajusta o LED pela leitura do LDR;
+// uma escrita no LED (sysfs, LED class ou led_ramp) o desliga.
+static ssize_t auto_show(struct kobject *sys_obj, struct kobj_attribute *attr, char *buff) {
+    long fields[AUTO_FIELD_COUNT];
+
+    if (usb_send_cmd(to_smartlamp(sys_obj), CMD_GET_AUTO, 0, fields) < 0) {
+        printk(KERN_ERR "SmartLamp: Erro ao ler auto\n");
+        return -EIO;
+    }
+    return sprintf(buff, "%ld\n", fields[AUTO_ENABLED]);
+}
+
+static ssize_t auto_store(struct kobject *sys_obj, struct kobj_attribute *attr, const char *buff, size_t count) {
+    bool on;
+
+    if (kstrtobool(buff, &on)) {
+        printk(KERN_ALERT "SmartLamp: valor de auto invalido.\n");
+        return -EINVAL;
+    }
+    if (usb_send_cmd(to_smartlamp(sys_obj), CMD_AUTO, on, NULL) < 0) {
+        printk(KERN_ALERT "SmartLamp: firmware recusou o controle automatico.\n");
+        return -EIO;
+    }
+    return count;
+}
+
+// /sys/kernel/smartlamp/lampN/auto_config: "<setpoint> <kp> <ki> <histerese> <mínimo> <máximo>", com o setpoint e
+// a histerese na escala do LDR (0 a 100), os ganhos em milésimos e os limites do LED (0 a 100)
+static ssize_t auto_config_show(struct kobject *sys_obj, struct kobj_attribute *attr, char *buff) {
+    long fields[AUTO_FIELD_COUNT];
+    int i, len = 0;
+
+    if (usb_send_cmd(to_smartlamp(sys_obj), CMD_GET_AUTO, 0, fields) < 0) {
+        printk(KERN_ERR "SmartLamp: Erro ao ler auto_config\n");
+        return -EIO;
+    }
+    for (i = AUTO_SETPOINT; i <= AUTO_MAX; i++)
+        len += sysfs_emit_at(buff, len, "%s%ld", i > AUTO_SETPOINT ? " " : "", fields[i]);
+    len += sysfs_emit_at(buff, len, "\n");
+    return len;
+}
+
+static ssize_t auto_config_store(struct kobject *sys_obj, struct kobj_attribute *attr, const char *buff, size_t count) {
+    int setpoint, kp, ki, hyst, led_min, led_max;
+
+    if (sscanf(buff, "%d %d %d %d %d %d", &setpoint, &kp, &ki, &hyst, &led_min, &led_max) != AUTO_CONFIG_COUNT ||
+        setpoint < 0 || setpoint > 100 || hyst < 0 || hyst > 100 ||
+        kp < 0 || kp > AUTO_GAIN_MAX || ki < 0 || ki > AUTO_GAIN_MAX ||
+        led_min < 0 || led_min > led_max || led_max > sensor_table[SENSOR_LED].max) {
+        printk(KERN_ALERT "SmartLamp: use \"<setpoint> <kp> <ki> <histerese> <minimo> <maximo>\".\n");
+        return -EINVAL;
+    }
+    if (usb_send_cmd_args(to_smartlamp(sys_obj), CMD_SET_AUTO, (int[]){ setpoint, kp, ki, hyst, led_min, led_max }, NULL) < 0) {
+        printk(KERN_ALERT "SmartLamp: firmware recusou a configuracao do controle automatico.\n");
+        return -EIO;
+    }
+    return count;
+}
+
+// /sys/kernel/smartlamp/lampN/auto_status: "<ligado> <ldr> <led> <parado>", com o LDR e a saída do controle
+// em duas casas decimais e parado = 1 quando o erro está dentro da histerese
+static ssize_t auto_status_show(struct kobject *sys_obj, struct kobj_attribute *attr, char *buff) {
+    long fields[AUTO_FIELD_COUNT];
+    int len;
+
+    if (usb_send_cmd(to_smartlamp(sys_obj), CMD_GET_AUTO, 0, fields) < 0) {
+        printk(KERN_ERR "SmartLamp: Erro ao ler auto_status\n");
+        return -EIO;
+    }
+    len = sysfs_emit(buff, "%ld ", fields[AUTO_ENABLED]);
+    len += format_value(buff, len, FMT_CENTI, fields[AUTO_LDR]);
+    len += sysfs_emit_at(buff, len, " ");
+    len += format_value(buff, len, FMT_CENTI, fields[AUTO_LED]);
+    len += sysfs_emit_at(buff, len, " %ld\n", fields[AUTO_SETTLED]);
+    return len;
+}
+
+// /sys/kernel/smartlamp/lampN/sample_time: uma linha "<sensor> <valor> <instante>" por sensor válido, com o
+// instante da amostra em ns de CLOCK_MONOTONIC (o mesmo de clock_gettime e ktime_get_ns). Valor e instante
+// vêm da mesma leitura do snapshot, então podem ser comparados com outros sensores do host.
+static ssize_t sample_time_show(struct kobject *sys_obj, struct kobj_attribute *attr, char *buff) {
+    struct smartlamp *dev = to_smartlamp(sys_obj);
+    struct smartlamp_snapshot snap;
+    unsigned int seq;
+    long value;
+    int i, len = 0;
+
+    // Atualiza o snapshot se estiver velho, como na leitura de um sensor
+    snapshot_get(dev, SENSOR_LED, &value);
+
+    do {
+        seq = read_seqbegin(&dev->snapshot_lock);
+        snap = dev->snapshot;
+    } while (read_seqretry(&dev->snapshot_lock, seq));
+
+    for (i = 0; i < SENSOR_COUNT; i++) {
+        if (!(snap.valid & BIT(i)))
+            continue;
+        len += sysfs_emit_at(buff, len, "%s ", sensor_table[i].name);
+        len += format_value(buff, len, sensor_table[i].fmt, snap.value[i]);
+        len += sysfs_emit_at(buff, len, " %llu\n", snap.time_ns[i]);
+    }
+    return len;
+}
+
+// /sys/kernel/smartlamp/lampN/clock: "<offset_ns> <deriva_ppb> <rtt_ns> <rtt_min_ns> <rtt_medio_ns> <jitter_ns> <pares>".
+// offset_ns é o instante do host em que o relógio do ESP32 marcaria zero; tudo zero sem GET_ALL_TS.
+static ssize_t clock_show(struct kobject *sys_obj, struct kobj_attribute *attr, char *buff) {
+    struct smartlamp *dev = to_smartlamp(sys_obj);
+    struct smartlamp_clock c;
+
+    spin_lock_irq(&dev->clock_lock);
+    c = dev->clock;
+    spin_unlock_irq(&dev->clock_lock);
+
+    return sysfs_emit(buff, "%lld %lld %llu %llu %llu %llu %llu\n",
+                      (s64)(c.ref_host_ns - c.ref_dev_us * NSEC_PER_USEC), c.drift_ppb, c.rtt_ns, c.rtt_min_ns,
+                      c.rtt_avg_ns, c.jitter_ns, c.samples);
+}
+
+// ---
+
+// LED class: /sys/class/leds/smartlampN::/brightness (0 a 100) e os gatilhos do kernel (timer, heartbeat, ...).
+// brightness_set só guarda o valor e agenda o worker, que envia apenas o pedido mais recente: escritas mais
+// rápidas que a USB substituem umas às outras em vez de formar fila. Quem precisa da confirmação usa o caminho
+// síncrono, /sys/kernel/smartlamp/lampN/led (ou led_set_brightness_sync no kernel), que espera a resposta.
+
+// Envia SET_LED e atualiza o snapshot (chamada com led_mutex adquirido)
+static int smartlamp_led_send(struct smartlamp *dev, int value) {
+    int ret = usb_send_cmd(dev, CMD_SET_LED, value, NULL);
+
+    if (ret == 0)
+        snapshot_set(dev, SENSOR_LED, value);
+    return ret;
+}
+
+// SET_LED síncrono. Um valor pendente do LED class pedido antes desta escrita é descartado.
+static int smartlamp_set_led(struct smartlamp *dev, int value) {
+    int ret;
+
+    mutex_lock(&dev->led_mutex);
+    xchg(&dev->led_pending, -1);
+    ret = smartlamp_led_send(dev, value);
+    mutex_unlock(&dev->led_mutex);
+    return ret;
+}
+
+// Transição feita no firmware (SET_LED_RAMP): uma única transação no lugar de um SET_LED por degrau.
+// Como uma escrita síncrona, descarta um valor pendente do LED class.
+static int smartlamp_led_ramp(struct smartlamp *dev, int target, int ms, int curve) {
+    int ret;
+
+    mutex_lock(&dev->led_mutex);
+    xchg(&dev->led_pending, -1);
+    ret = usb_send_cmd_args(dev, CMD_SET_LED_RAMP, (int[]){ target, ms, curve }, NULL);
+    if (ret == 0)
+        snapshot_set(dev, SENSOR_LED, target);   // GET_LED responde o destino desde o início da transição
+    mutex_unlock(&dev->led_mutex);
+    return ret;
+}
+
+static void smartlamp_led_work_fn(struct work_struct *work) {
+    struct smartlamp *dev = container_of(work, struct smartlamp, led_work);
+    int value;
+
+    mutex_lock(&dev->led_mutex);
+    while ((value = xchg(&dev->led_pending, -1)) >= 0) {
+        if (smartlamp_led_send(dev, value) < 0)
+            printk_ratelimited(KERN_ERR "SmartLamp: erro ao setar o LED de lamp%d em %d.\n", dev->index, value);
+    }
+    mutex_unlock(&dev->led_mutex);
+}
+
+// Pode ser chamada em contexto atômico (e.g., gatilho timer): não toca na USB
+static void smartlamp_led_brightness_set(struct led_classdev *led_cdev, enum led_brightness brightness) {
+    struct smartlamp *dev = container_of(led_cdev, struct smartlamp, led_cdev);
+
+    if (!READ_ONCE(dev->led_live))
+        return;
+    xchg(&dev->led_pending, brightness);
+    schedule_work(&dev->led_work);
+}
+
+static int smartlamp_led_brightness_set_blocking(struct led_classdev *led_cdev, enum led_brightness brightness) {
+    struct smartlamp *dev = container_of(led_cdev, struct smartlamp, led_cdev);
+
+    if (!READ_ONCE(dev->led_live))
+        return 0;
+    return smartlamp_set_led(dev, brightness) < 0 ? -EIO : 0;
+}
+
+// Brilho lido do snapshot, que também reflete escritas feitas por /sys/kernel/smartlamp/lampN/led
+static enum led_brightness smartlamp_led_brightness_get(struct led_classdev *led_cdev) {
+    struct smartlamp *dev = container_of(led_cdev, struct smartlamp, led_cdev);
+    long value;
+
+    if (snapshot_get(dev, SENSOR_LED, &value) < 0)
+        return led_cdev->brightness;
+    return value;
+}
+
+static int smartlamp_led_init(struct smartlamp *dev) {
+    struct led_classdev *led_cdev = &dev->led_cdev;
+
+    snprintf(dev->led_name, sizeof(dev->led_name), "smartlamp%d::", dev->index);
+    led_cdev->name = dev->led_name;
+    led_cdev->max_brightness = sensor_table[SENSOR_LED].max;
+    led_cdev->brightness_set = smartlamp_led_brightness_set;
+    led_cdev->brightness_set_blocking = smartlamp_led_brightness_set_blocking;
+    led_cdev->brightness_get = smartlamp_led_brightness_get;
+    led_cdev->flags = LED_HW_PLUGGABLE | LED_RETAIN_AT_SHUTDOWN;  // rmmod não apaga a lâmpada
+    WRITE_ONCE(dev->led_live, true);
+    return led_classdev_register(&dev->interface->dev, led_cdev);
+}
+
+// Remove o LED class antes dos últimos comandos do disconnect. Ao desligar um gatilho ativo (timer, heartbeat),
+// o núcleo de LEDs pede LED_OFF: o pedido é ignorado, e um valor ainda pendente é descartado sem ser enviado.
+static void smartlamp_led_remove(struct smartlamp *dev) {
+    WRITE_ONCE(dev->led_live, false);
+    led_classdev_unregister(&dev->led_cdev);
+    xchg(&dev->led_pending, -1);
+    cancel_work_sync(&dev->led_work);
+}
+
+// ---
+
+// Dispositivo IIO: LDR (IIO_LIGHT), temperatura (IIO_TEMP) e umidade (IIO_HUMIDITYRELATIVE).
+// A leitura direta (in_*_raw) vem do snapshot, como no sysfs. No modo buffer, o gatilho da lâmpada dispara a cada
+// amostra publicada (amostrador ou STREAM) e cada registro leva o instante da amostra convertido para o relógio
+// escolhido em current_timestamp_clock. Outros gatilhos (e.g., iio-trig-hrtimer) também funcionam: nesse caso
+// o registro leva os últimos valores conhecidos e o instante do disparo.
+//
+//   iio_readdev -t smartlamp-lamp0 -s 100 smartlamp
+
+// Canais do buffer, na ordem de scan_index; address é o sensor em sensor_table
+#define SMARTLAMP_IIO_CHAN(_type, _sensor, _index, _info) {                       \
+    .type = _type,                                                                \
+    .address = _sensor,                                                           \
+    .info_mask_separate = _info,                                                  \
+    .scan_index = _index,                                                         \
+    .scan_type = { .sign = 's', .realbits = 32, .storagebits = 32, .endianness = IIO_CPU }, \
+}
+
+static const struct iio_chan_spec smartlamp_iio_channels[] = {
+    SMARTLAMP_IIO_CHAN(IIO_LIGHT, SENSOR_LDR, 0, BIT(IIO_CHAN_INFO_RAW)),     // 0 a 100, sem calibração em lux
+    SMARTLAMP_IIO_CHAN(IIO_TEMP, SENSOR_TEMP, 1, BIT(IIO_CHAN_INFO_RAW) | BIT(IIO_CHAN_INFO_SCALE)),
+    SMARTLAMP_IIO_CHAN(IIO_HUMIDITYRELATIVE, SENSOR_HUM, 2, BIT(IIO_CHAN_INFO_RAW) | BIT(IIO_CHAN_INFO_SCALE)),
+    IIO_CHAN_SOFT_TIMESTAMP(3),
+};
+
+#define SMARTLAMP_IIO_SENSORS (ARRAY_SIZE(smartlamp_iio_channels) - 1)
+
+static struct smartlamp *smartlamp_from_iio(struct iio_dev *indio) {
+    return *(struct smartlamp **)iio_priv(indio);
+}
+
+static int smartlamp_iio_read_raw(struct iio_dev *indio, struct iio_chan_spec const *chan,
+                                  int *val, int *val2, long mask) {
+    long value;
+
+    switch (mask) {
+    case IIO_CHAN_INFO_RAW:
+        if (snapshot_get(smartlamp_from_iio(indio), chan->address, &value) < 0)
+            return -EIO;
+        *val = value;
+        return IIO_VAL_INT;
+    case IIO_CHAN_INFO_SCALE:   // Centésimos para as unidades do IIO (mili °C e mili %)
+        *val = 10;
+        return IIO_VAL_INT;
+    }
+    return -EINVAL;
+}
+
+static const struct iio_info smartlamp_iio_info = {
+    .read_raw = smartlamp_iio_read_raw,
+};
+
+// Guarda os valores da amostra para o próximo disparo e agenda o gatilho (chamada com readers_lock adquirido).
+// Amostras STREAM trazem um só sensor: os demais mantêm o último valor conhecido.
+static void smartlamp_iio_update(struct smartlamp *dev, const struct smartlamp_sample *sample) {
+    struct smartlamp_sample *latest = &dev->iio_latest;
+    int i;
+
+    // Registros recuperados do firmware são antigos: o buffer IIO só recebe amostras ao vivo
+    if (!dev->iio_live || (sample->valid & SMARTLAMP_SAMPLE_LOG))
+        return;
+
+    if (!(sample->valid & SMARTLAMP_SAMPLE_STREAM))
+        latest->valid = 0;
+    for (i = 0; i < SENSOR_COUNT; i++) {
+        if (sample->valid & BIT(i)) {
+            sample_set_value(latest, i, sample_get_value(sample, i));
+            latest->valid |= BIT(i);
+        }
+    }
+    latest->timestamp_ns = sample->timestamp_ns;
+    irq_work_queue(&dev->iio_work);
+}
+
+// iio_trigger_poll precisa de contexto de interrupção; amostras do amostrador chegam de uma workqueue
+static void smartlamp_iio_work_fn(struct irq_work *work) {
+    struct smartlamp *dev = container_of(work, struct smartlamp, iio_work);
+
+    iio_trigger_poll(dev->iio_trig);
+}
+
+// Monta o registro dos canais ativos e o coloca no buffer. Um registro com algum sensor ativo
+// sem valor (e.g., DHT sem resposta) é descartado.
+static irqreturn_t smartlamp_iio_trigger_handler(int irq, void *p) {
+    struct iio_poll_func *pf = p;
+    struct iio_dev *indio = pf->indio_dev;
+    struct smartlamp *dev = smartlamp_from_iio(indio);
+    struct smartlamp_sample latest;
+    struct {
+        s32 value[SMARTLAMP_IIO_SENSORS];
+        s64 timestamp __aligned(8);
+    } scan;
+    s64 timestamp;
+    int bit, i = 0;
+
+    spin_lock_irq(&dev->readers_lock);
+    latest = dev->iio_latest;
+    spin_unlock_irq(&dev->readers_lock);
+
+    memset(&scan, 0, sizeof(scan));
+    iio_for_each_active_channel(indio, bit) {
+        enum smartlamp_sensor sensor = smartlamp_iio_channels[bit].address;
+
+        if (bit >= SMARTLAMP_IIO_SENSORS)
+            break;
+        if (!(latest.valid & BIT(sensor)))
+            goto done;
+        scan.value[i++] = sample_get_value(&latest, sensor);
+    }
+
+    // Com o próprio gatilho, o instante é o da amostra (ktime_get_ns), levado ao relógio do dispositivo IIO
+    if (iio_trigger_using_own(indio))
+        timestamp = latest.timestamp_ns + iio_get_time_ns(indio) - ktime_get_ns();
+    else
+        timestamp = pf->timestamp;
+    iio_push_to_buffers_with_timestamp(indio, &scan, timestamp);
+
+done:
+    iio_trigger_notify_done(indio->trig);
+    return IRQ_HANDLED;
+}
+
+// Registra iio:deviceN (nome "smartlamp", rótulo "lampN") e o gatilho "smartlamp-lampN", já escolhido como o atual
+static int smartlamp_iio_init(struct smartlamp *dev) {
+    struct iio_dev *indio;
+    int ret;
+
+    indio = iio_device_alloc(&dev->interface->dev, sizeof(dev));
+    if (!indio)
+        return -ENOMEM;
+    *(struct smartlamp **)iio_priv(indio) = dev;
+    indio->name = "smartlamp";
+    indio->label = kobject_name(&dev->kobj);
+    indio->info = &smartlamp_iio_info;
+    indio->channels = smartlamp_iio_channels;
+    indio->num_channels = ARRAY_SIZE(smartlamp_iio_channels);
+    indio->modes = INDIO_DIRECT_MODE;
+
+    dev->iio_trig = iio_trigger_alloc(&dev->interface->dev, "%s-lamp%d", indio->name, dev->index);
+    if (!dev->iio_trig) {
+        ret = -ENOMEM;
+        goto err_free;
+    }
+    ret = iio_trigger_register(dev->iio_trig);
+    if (ret)
+        goto err_trig_free;
+    indio->trig = iio_trigger_get(dev->iio_trig);
+
+    ret = iio_triggered_buffer_setup(indio, iio_pollfunc_store_time, smartlamp_iio_trigger_handler, NULL);
+    if (ret)
+        goto err_trig_unregister;
+
+    ret = iio_device_register(indio);
+    if (ret)
+        goto err_buffer;
+
+    dev->indio = indio;
+    spin_lock_irq(&dev->readers_lock);
+    dev->iio_live = true;
+    spin_unlock_irq(&dev->readers_lock);
+    return 0;
+
+err_buffer:
+    iio_triggered_buffer_cleanup(indio);
+err_trig_unregister:
+    iio_trigger_unregister(dev->iio_trig);
+err_trig_free:
+    iio_trigger_free(dev->iio_trig);
+err_free:
+    iio_device_free(indio);   // Solta também a referência de indio->trig
+    return ret;
+}
+
+static void smartlamp_iio_remove(struct smartlamp *dev) {
+    // Nenhuma amostra nova dispara o gatilho; espera um disparo já agendado
+    spin_lock_irq(&dev->readers_lock);
+    dev->iio_live = false;
+    spin_unlock_irq(&dev->readers_lock);
+    irq_work_sync(&dev->iio_work);
+
+    iio_device_unregister(dev->indio);
+    iio_triggered_buffer_cleanup(dev->indio);
+    iio_trigger_unregister(dev->iio_trig);
+    iio_trigger_free(dev->iio_trig);
+    iio_device_free(dev->indio);
+}
+
+// ---
+
+// Executado na abertura de /dev/smartlampN: cria a fila de amostras do novo leitor.
+// A fila começa com os registros recuperados do firmware no probe (os LOG_REPLAY_LEN mais recentes, com o seq
+// original); das amostras ao vivo, só as obtidas depois da abertura são entregues.
+static int smartlamp_cdev_open(struct inode *inode, struct file *file) {
+    struct smartlamp *dev = container_of(file->private_data, struct smartlamp, misc);
+    struct smartlamp_reader *reader;
+    u32 i;
+
+    reader = kzalloc(sizeof(*reader), GFP_KERNEL);
+    if (!reader)
+        return -ENOMEM;
+
+    INIT_KFIFO(reader->fifo);
+    mutex_init(&reader->read_mutex);
+    reader->dev = dev;
+    kobject_get(&dev->kobj);                // A estrutura vive até o último close(), mesmo após o disconnect
+
+    spin_lock_irq(&dev->readers_lock);
+    for (i = dev->log_replayed - min_t(u32, dev->log_replayed, LOG_REPLAY_LEN); i != dev->log_replayed; i++)
+        kfifo_put(&reader->fifo, dev->log_replay[i % LOG_REPLAY_LEN]);
+    list_add_tail(&reader->node, &dev->readers);
+    spin_unlock_irq(&dev->readers_lock);
+
+    file->private_data = reader;
+    return stream_open(inode, file);
+}
+
+static int smartlamp_cdev_release(struct inode *inode, struct file *file) {
+    struct smartlamp_reader *reader = file->private_data;
+    struct smartlamp *dev = reader->dev;
+
+    spin_lock_irq(&dev->readers_lock);
+    list_del(&reader->node);
+    spin_unlock_irq(&dev->readers_lock);
+
+    kfree(reader);
+    kobject_put(&dev->kobj);
+    return 0;
+}
+
+// Executado quando /dev/smartlampN é lido: copia quantos registros inteiros couberem no buffer.
+// Bloqueia até chegar uma amostra, a menos que o arquivo tenha sido aberto com O_NONBLOCK.
+static ssize_t smartlamp_cdev_read(struct file *file, char __user *buf, size_t count, loff_t *ppos) {
+    struct smartlamp_reader *reader = file->private_data;
+    struct smartlamp *dev = reader->dev;
+    unsigned int copied;
+    int ret;
+
+    if (count < sizeof(struct smartlamp_sample))
+        return -EINVAL;
+
+    for (;;) {
+        if (mutex_lock_interruptible(&reader->read_mutex))
+            return -ERESTARTSYS;
+        ret = kfifo_to_user(&reader->fifo, buf, count, &copied);
+        mutex_unlock(&reader->read_mutex);
+        if (ret)
+            return ret;
+        if (copied)
+            return copied;
+
+        if (READ_ONCE(dev->disconnected))
+            return -ENODEV;
+        if (file->f_flags & O_NONBLOCK)
+            return -EAGAIN;
+        if (wait_event_interruptible(dev->read_wq,
+                                     !kfifo_is_empty(&reader->fifo) || READ_ONCE(dev->disconnected)))
+            return -ERESTARTSYS;
+    }
+}
+
+// Mapeia o anel de amostras (somente leitura). O mapeamento segura o arquivo aberto e, com ele, a lâmpada.
+static int smartlamp_cdev_mmap(struct file *file, struct vm_area_struct *vma) {
+    struct smartlamp_reader *reader = file->private_data;
+
+    if (vma->vm_flags & VM_WRITE)
+        return -EPERM;
+    vm_flags_clear(vma, VM_MAYWRITE);
+    return remap_vmalloc_range(vma, reader->dev->ring, vma->vm_pgoff);
+}
+
+// Suporte a poll()/select()/epoll: legível quando há amostras na fila do leitor
+static __poll_t smartlamp_cdev_poll(struct file *file, poll_table *wait) {
+    struct smartlamp_reader *reader = file->private_data;
+    struct smartlamp *dev = reader->dev;
+    __poll_t mask = 0;
+
+    poll_wait(file, &dev->read_wq, wait);
+    if (!kfifo_is_empty(&reader->fifo))
+        mask |= EPOLLIN | EPOLLRDNORM;
+    if (READ_ONCE(dev->disconnected))
+        mask |= EPOLLHUP | EPOLLERR;
+    return mask;
+}
+
+// ---
+
+// /sys/kernel/debug/smartlamp/lampN/stats: contadores, bytes e histograma de latência de cada comando
+static int smartlamp_stats_show(struct seq_file *m, void *unused) {
+    struct smartlamp *dev = m->private;
+    struct smartlamp_cmd_stats st;
+    u64 rx_bytes, rx_chunks;
+    unsigned long crc_errors, flags;
+    int i, b;
+
+    spin_lock_irqsave(&dev->recv_lock, flags);
+    rx_bytes = dev->rx_bytes;
+    rx_chunks = dev->rx_chunks;
+    crc_errors = dev->crc_errors;
+    spin_unlock_irqrestore(&dev->recv_lock, flags);
+
+    seq_printf(m, "rx: %llu bytes em %llu blocos, %lu quadros corrompidos\n\n", rx_bytes, rx_chunks, crc_errors);
+    seq_printf(m, "%-15s %8s %7s %8s %10s %10s %10s %10s %9s\n", "comando", "total", "erros", "timeouts",
+               "bytes_out", "bytes_in", "media_us", "max_us", "coalesc");
+
+    for (i = 0; i < CMD_COUNT; i++) {
+        spin_lock(&dev->stats_lock);
+        st = dev->stats[i];
+        spin_unlock(&dev->stats_lock);
+
+        if (!st.count)
+            continue;
+        seq_printf(m, "%-15s %8llu %7llu %8llu %10llu %10llu %10llu %10llu %9llu\n", cmd_table[i].wire, st.count,
+                   st.errors, st.timeouts, st.bytes_out, st.bytes_in, div64_u64(st.total_ns, st.count * NSEC_PER_USEC),
+                   div_u64(st.max_ns, NSEC_PER_USEC), st.coalesced);
+        for (b = 0; b < LAT_HIST_BUCKETS; b++) {
+            if (!st.hist[b])
+                continue;
+            if (b == 0)
+                seq_printf(m, "    %8s  < %8u us: %llu\n", "", 1, st.hist[b]);
+            else if (b == LAT_HIST_BUCKETS - 1)
+                seq_printf(m, "    %8llu ..  %8s us: %llu\n", 1ULL << (b - 1), "", st.hist[b]);
+            else
+                seq_printf(m, "    %8llu .. %8llu us: %llu\n", 1ULL << (b - 1), (1ULL << b) - 1, st.hist[b]);
+        }
+    }
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(smartlamp_stats);
+
+// /sys/kernel/debug/smartlamp/lampN/reset: qualquer escrita zera as estatísticas (e.g., antes de um benchmark)
+static ssize_t smartlamp_reset_write(struct file *file, const char __user *buf, size_t count, loff_t *ppos) {
+    struct smartlamp *dev = file->private_data;
+    unsigned long flags;
+
+    spin_lock(&dev->stats_lock);
+    memset(dev->stats, 0, sizeof(dev->stats));
+    spin_unlock(&dev->stats_lock);
+
+    spin_lock_irqsave(&dev->recv_lock, flags);
+    dev->rx_bytes = 0;
+    dev->rx_chunks = 0;
+    dev->crc_errors = 0;
+    spin_unlock_irqrestore(&dev->recv_lock, flags);
+    return count;
+}
+
+static const struct file_operations smartlamp_reset_fops = {
+    .owner = THIS_MODULE,
+    .open  = simple_open,
+    .write = smartlamp_reset_write,
+};
+
+static void smartlamp_debugfs_init(struct smartlamp *dev) {
+    char name[16];
+
+    snprintf(name, sizeof(name), "lamp%d", dev->index);
+    dev->debugfs = debugfs_create_dir(name, smartlamp_debugfs);
+    debugfs_create_file("stats", 0444, dev->debugfs, dev, &smartlamp_stats_fops);
+    debugfs_create_file("reset", 0200, dev->debugfs, dev, &smartlamp_reset_fops);
+}
@@ -0,0 +1,26 @@
+#ifndef SMARTLAMP_H
+#define SMARTLAMP_H
+
+// Interface exportada pelo smartlamp.ko para outros módulos do kernel (e.g., smartlamp-configfs.ko).
+// Os comandos passam pelo mesmo transporte do sysfs: janela de comandos com tag, montagem de linhas
+// (ou quadros binários), resposta conferida com o comando enviado e timeout.
+
+struct smartlamp;
+
+// Sensores da lâmpada (índices de sensor_table no smartlamp.c)
+enum smartlamp_sensor {
+    SENSOR_LED,
+    SENSOR_LDR,
+    SENSOR_TEMP,   // Centésimos de grau (e.g., 2530 = 25.30)
+    SENSOR_HUM,    // Centésimos de % (e.g., 6100 = 61.00)
+    SENSOR_COUNT
+};
+
+struct smartlamp *smartlamp_get(int index);  // Lâmpada lampN com uma referência (NULL se não estiver conectada)
+void smartlamp_put(struct smartlamp *dev);   // Solta a referência obtida com smartlamp_get
+int  smartlamp_read(struct smartlamp *dev, enum smartlamp_sensor sensor, long *value); // Lê o sensor no dispositivo
+int  smartlamp_read_all(struct smartlamp *dev, long *value, unsigned long *valid); // Todos os sensores numa transação (value[SENSOR_COUNT])
+int  smartlamp_write(struct smartlamp *dev, enum smartlamp_sensor sensor, long value); // Escreve no sensor (e.g., LED)
+int  smartlamp_format(char *buf, enum smartlamp_sensor sensor, long value); // Valor como no sysfs (e.g., "25.30"), sem '\n'
+
+#endif
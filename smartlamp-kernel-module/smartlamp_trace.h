@@ -0,0 +1,171 @@
+// Tracepoints do driver SmartLamp (ftrace/perf): envio de comandos, blocos recebidos da USB, respostas,
+// novas tentativas e timeouts, todos com a duração medida.
+//
+//   echo 1 > /sys/kernel/tracing/events/smartlamp/enable
+//   cat /sys/kernel/tracing/trace_pipe
+//   perf trace -e 'smartlamp:*'
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM smartlamp
+
+#if !defined(_SMARTLAMP_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _SMARTLAMP_TRACE_H
+
+#include <linux/tracepoint.h>
+
+// Comando enviado ao endpoint bulk OUT; wait_ns é o tempo esperando uma posição livre na janela
+TRACE_EVENT(smartlamp_cmd_submit,
+    TP_PROTO(int lamp, const char *cmd, u8 tag, bool binary, int len, u64 wait_ns),
+    TP_ARGS(lamp, cmd, tag, binary, len, wait_ns),
+    TP_STRUCT__entry(
+        __field(int, lamp)
+        __string(cmd, cmd)
+        __field(u8, tag)
+        __field(bool, binary)
+        __field(int, len)
+        __field(u64, wait_ns)
+    ),
+    TP_fast_assign(
+        __entry->lamp = lamp;
+        __assign_str(cmd);
+        __entry->tag = tag;
+        __entry->binary = binary;
+        __entry->len = len;
+        __entry->wait_ns = wait_ns;
+    ),
+    TP_printk("lamp%d cmd=%s tag=%u %s len=%d wait_ns=%llu", __entry->lamp, __get_str(cmd), __entry->tag,
+              __entry->binary ? "bin" : "text", __entry->len, __entry->wait_ns)
+);
+
+// Bloco recebido por uma URB de leitura; gap_ns é o intervalo desde o bloco anterior
+TRACE_EVENT(smartlamp_rx_chunk,
+    TP_PROTO(int lamp, int len, u64 gap_ns),
+    TP_ARGS(lamp, len, gap_ns),
+    TP_STRUCT__entry(
+        __field(int, lamp)
+        __field(int, len)
+        __field(u64, gap_ns)
+    ),
+    TP_fast_assign(
+        __entry->lamp = lamp;
+        __entry->len = len;
+        __entry->gap_ns = gap_ns;
+    ),
+    TP_printk("lamp%d len=%d gap_ns=%llu", __entry->lamp, __entry->len, __entry->gap_ns)
+);
+
+// Resposta entregue ao comando que a esperava; latency_ns é o tempo desde o envio
+TRACE_EVENT(smartlamp_resp_match,
+    TP_PROTO(int lamp, u8 tag, bool binary, u64 latency_ns),
+    TP_ARGS(lamp, tag, binary, latency_ns),
+    TP_STRUCT__entry(
+        __field(int, lamp)
+        __field(u8, tag)
+        __field(bool, binary)
+        __field(u64, latency_ns)
+    ),
+    TP_fast_assign(
+        __entry->lamp = lamp;
+        __entry->tag = tag;
+        __entry->binary = binary;
+        __entry->latency_ns = latency_ns;
+    ),
+    TP_printk("lamp%d tag=%u %s latency_ns=%llu", __entry->lamp, __entry->tag,
+              __entry->binary ? "bin" : "text", __entry->latency_ns)
+);
+
+// Comando que não pôde seguir na primeira tentativa (reason: "window" quando a janela estava cheia,
+// "baud" quando o probe repete o teste na velocidade negociada); waited_ns é o tempo perdido até ali
+TRACE_EVENT(smartlamp_cmd_retry,
+    TP_PROTO(int lamp, const char *cmd, const char *reason, u64 waited_ns),
+    TP_ARGS(lamp, cmd, reason, waited_ns),
+    TP_STRUCT__entry(
+        __field(int, lamp)
+        __string(cmd, cmd)
+        __string(reason, reason)
+        __field(u64, waited_ns)
+    ),
+    TP_fast_assign(
+        __entry->lamp = lamp;
+        __assign_str(cmd);
+        __assign_str(reason);
+        __entry->waited_ns = waited_ns;
+    ),
+    TP_printk("lamp%d cmd=%s reason=%s waited_ns=%llu", __entry->lamp, __get_str(cmd), __get_str(reason),
+              __entry->waited_ns)
+);
+
+// Comando desistido por tempo (stage: "window" esperando posição na janela, "response" esperando a resposta)
+TRACE_EVENT(smartlamp_cmd_timeout,
+    TP_PROTO(int lamp, const char *cmd, u8 tag, const char *stage, u64 waited_ns),
+    TP_ARGS(lamp, cmd, tag, stage, waited_ns),
+    TP_STRUCT__entry(
+        __field(int, lamp)
+        __string(cmd, cmd)
+        __field(u8, tag)
+        __string(stage, stage)
+        __field(u64, waited_ns)
+    ),
+    TP_fast_assign(
+        __entry->lamp = lamp;
+        __assign_str(cmd);
+        __entry->tag = tag;
+        __assign_str(stage);
+        __entry->waited_ns = waited_ns;
+    ),
+    TP_printk("lamp%d cmd=%s tag=%u stage=%s waited_ns=%llu", __entry->lamp, __get_str(cmd), __entry->tag,
+              __get_str(stage), __entry->waited_ns)
+);
+
+// Fim de um comando, com o resultado e a duração total (janela + envio + resposta + conversão)
+TRACE_EVENT(smartlamp_cmd_done,
+    TP_PROTO(int lamp, const char *cmd, u8 tag, int ret, u64 duration_ns),
+    TP_ARGS(lamp, cmd, tag, ret, duration_ns),
+    TP_STRUCT__entry(
+        __field(int, lamp)
+        __string(cmd, cmd)
+        __field(u8, tag)
+        __field(int, ret)
+        __field(u64, duration_ns)
+    ),
+    TP_fast_assign(
+        __entry->lamp = lamp;
+        __assign_str(cmd);
+        __entry->tag = tag;
+        __entry->ret = ret;
+        __entry->duration_ns = duration_ns;
+    ),
+    TP_printk("lamp%d cmd=%s tag=%u ret=%d duration_ns=%llu", __entry->lamp, __get_str(cmd), __entry->tag,
+              __entry->ret, __entry->duration_ns)
+);
+
+// Par envio/resposta de GET_ALL_TS usado na correlação com o relógio do ESP32: residual_ns é o meio do par menos
+// o instante previsto para a resposta e used indica se o par corrigiu a referência (ida e volta perto da menor)
+TRACE_EVENT(smartlamp_clock_sync,
+    TP_PROTO(int lamp, u64 rtt_ns, s64 residual_ns, s64 drift_ppb, bool used),
+    TP_ARGS(lamp, rtt_ns, residual_ns, drift_ppb, used),
+    TP_STRUCT__entry(
+        __field(int, lamp)
+        __field(u64, rtt_ns)
+        __field(s64, residual_ns)
+        __field(s64, drift_ppb)
+        __field(bool, used)
+    ),
+    TP_fast_assign(
+        __entry->lamp = lamp;
+        __entry->rtt_ns = rtt_ns;
+        __entry->residual_ns = residual_ns;
+        __entry->drift_ppb = drift_ppb;
+        __entry->used = used;
+    ),
+    TP_printk("lamp%d rtt_ns=%llu residual_ns=%lld drift_ppb=%lld%s", __entry->lamp, __entry->rtt_ns,
+              __entry->residual_ns, __entry->drift_ppb, __entry->used ? "" : " (descartado)")
+);
+
+#endif // _SMARTLAMP_TRACE_H
+
+// O cabeçalho fica ao lado do smartlamp.c e não em include/trace/events
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE smartlamp_trace
+#include <trace/define_trace.h>
@@ -0,0 +1,58 @@
+#ifndef SMARTLAMP_UAPI_H
+#define SMARTLAMP_UAPI_H
+
+// Estruturas compartilhadas entre o driver e os programas que leem /dev/smartlampN.
+// Incluído tanto pelo módulo quanto por programas em espaço de usuário.
+
+#include <linux/types.h>
+
+// Bits de smartlamp_sample.valid: indicam quais campos foram lidos com sucesso
+#define SMARTLAMP_VALID_LED   (1U << 0)
+#define SMARTLAMP_VALID_LDR   (1U << 1)
+#define SMARTLAMP_VALID_TEMP  (1U << 2)
+#define SMARTLAMP_VALID_HUM   (1U << 3)
+#define SMARTLAMP_SAMPLE_STREAM (1U << 31)  // Amostra enviada pelo firmware no modo STREAM (apenas um sensor válido)
+#define SMARTLAMP_SAMPLE_LOG    (1U << 30)  // Amostra do registro do firmware, recuperada depois de uma desconexão
+
+// Ordem das amostras: seq sempre cresce, mas timestamp_ns não. Os registros SMARTLAMP_SAMPLE_LOG são
+// recuperados no probe, antes de o amostrador começar, e ficam à frente das amostras ao vivo; só uma amostra
+// STREAM pedida durante a recuperação pode se intercalar com eles. Quem abre /dev/smartlampN depois recebe
+// primeiro os registros recuperados mais recentes (até 256, com o seq original), então o salto em seq entre
+// eles e a primeira amostra ao vivo não indica perda. O anel mapeado não repete os registros.
+
+// Amostra de todos os sensores. O read() de /dev/smartlampN devolve apenas registros inteiros.
+struct smartlamp_sample {
+    __u64 timestamp_ns;   // CLOCK_MONOTONIC (ktime_get_ns) da amostra no ESP32 (sem GET_ALL_TS, da chegada da resposta)
+    __u32 seq;            // Número sequencial da amostra (saltos indicam amostras perdidas)
+    __u32 valid;          // SMARTLAMP_VALID_*, SMARTLAMP_SAMPLE_STREAM e SMARTLAMP_SAMPLE_LOG
+    __s32 led;            // Intensidade do LED (0 a 100)
+    __s32 ldr;            // Luminosidade (0 a 100)
+    __s32 temp;           // Temperatura em centésimos de grau (2530 = 25.30)
+    __s32 hum;            // Umidade em centésimos de % (6100 = 61.00)
+};
+
+// Anel de amostras mapeado com mmap() a partir de /dev/smartlampN (somente leitura), para leitores que
+// consomem amostras sem chamadas de sistema. O início do mapeamento é um struct smartlamp_ring_header e
+// as entradas (struct smartlamp_sample) começam em data_offset.
+//
+// O driver é o único produtor. Para publicar a amostra de índice n (contado desde o probe), ele:
+//   1. se o anel está cheio, avança tail para n + 1 - entries (a entrada n % entries vai ser sobrescrita);
+//   2. escreve a entrada n % entries;
+//   3. publica head = n + 1 com store-release.
+// O leitor lê head com load-acquire, copia a entrada e depois relê tail: se tail passou do índice copiado,
+// a entrada pode ter sido sobrescrita durante a cópia e deve ser descartada (o leitor pulou para tail).
+// O campo seq de cada entrada é igual ao seu índice (truncado para 32 bits).
+#define SMARTLAMP_RING_MAGIC    0x474e5253  // "SRNG"
+#define SMARTLAMP_RING_VERSION  1
+
+struct smartlamp_ring_header {
+    __u32 magic;          // SMARTLAMP_RING_MAGIC
+    __u32 version;        // SMARTLAMP_RING_VERSION
+    __u32 entries;        // Quantidade de entradas (potência de 2)
+    __u32 entry_size;     // sizeof(struct smartlamp_sample)
+    __u64 data_offset;    // Posição (bytes) da primeira entrada, alinhada em página
+    __u64 head;           // Índice da próxima amostra a ser escrita
+    __u64 tail;           // Índice da amostra mais antiga ainda válida
+};
+
+#endif
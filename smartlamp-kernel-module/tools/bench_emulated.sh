@@ -0,0 +1,60 @@
+#!/bin/sh
+# Roda o smartlamp_bench contra uma SmartLamp emulada (smartlamp-emulator sobre dummy_hcd + raw_gadget),
+# sempre com os mesmos parâmetros de enlace e a mesma semente, para que execuções diferentes sejam comparáveis.
+#
+# Uso: sudo ./bench_emulated.sh [sysfs|configfs] [opções do smartlamp_bench]
+#      e.g. sudo ./bench_emulated.sh sysfs -t 8 -d 10 -f json -o sysfs.json -l $(git rev-parse --short HEAD)
+set -e
+
+MODE=${1:-sysfs}
+[ $# -gt 0 ] && shift
+
+TOOLS=$(cd "$(dirname "$0")" && pwd)
+MODULE_DIR=$(dirname "$TOOLS")
+EMULATOR_DIR=$MODULE_DIR/../smartlamp-emulator
+EMULATOR_OPTS=${EMULATOR_OPTS:---seed 1 --latency-us 300 --jitter-us 100}
+
+make -C "$EMULATOR_DIR" >/dev/null
+gcc -O2 -Wall -pthread -o "$TOOLS/smartlamp_bench" "$TOOLS/smartlamp_bench.c"
+
+modprobe dummy_hcd
+modprobe raw_gadget
+
+"$EMULATOR_DIR/smartlamp-emulator" $EMULATOR_OPTS &
+EMULATOR=$!
+trap 'rmmod smartlamp_configfs smartlamp 2>/dev/null; kill $EMULATOR 2>/dev/null' EXIT
+sleep 1
+
+# Os dois modos usam o smartlamp.ko: o configfs envia os comandos pelo transporte dele
+make -C "$MODULE_DIR" >/dev/null
+modprobe industrialio-triggered-buffer
+insmod "$MODULE_DIR/smartlamp.ko"
+while [ ! -e /sys/kernel/smartlamp/lamp0/led ]; do sleep 0.2; done
+
+case "$MODE" in
+sysfs)
+    "$TOOLS/smartlamp_bench" "$@" \
+        /sys/kernel/smartlamp/lamp0/led=50 \
+        /sys/kernel/smartlamp/lamp0/led \
+        /sys/kernel/smartlamp/lamp0/ldr \
+        /sys/kernel/smartlamp/lamp0/temp \
+        /sys/kernel/smartlamp/lamp0/hum
+    ;;
+configfs)
+    insmod "$MODULE_DIR/smartlamp-configfs.ko"
+    CFS=/sys/kernel/config/smartlamp
+    mkdir -p $CFS/led $CFS/ldr $CFS/dht
+
+    "$TOOLS/smartlamp_bench" "$@" \
+        $CFS/led/value=1 \
+        $CFS/led/value \
+        $CFS/ldr/value \
+        $CFS/dht/temperature \
+        $CFS/dht/humidity
+    rmdir $CFS/led $CFS/ldr $CFS/dht
+    ;;
+*)
+    echo "modo desconhecido: $MODE (use sysfs ou configfs)" >&2
+    exit 1
+    ;;
+esac
@@ -0,0 +1,48 @@
+#!/bin/sh
+# Testa a consistência do anel mapeado de /dev/smartlampN quando o produtor dá a volta no leitor.
+# Com a SmartLamp emulada (smartlamp-emulator sobre dummy_hcd + raw_gadget) em STREAM a 1000 Hz, o
+# smartlamp_ring só lê o anel a cada 2 s, tempo em que chegam mais amostras que as 1024 entradas.
+# Passa se houve amostras perdidas (o anel foi sobrescrito) e nenhuma entrada inconsistente.
+#
+# Uso: sudo ./ring_overrun.sh [duração_s]
+set -e
+
+DURATION=${1:-10}
+
+TOOLS=$(cd "$(dirname "$0")" && pwd)
+MODULE_DIR=$(dirname "$TOOLS")
+EMULATOR_DIR=$MODULE_DIR/../smartlamp-emulator
+EMULATOR_OPTS=${EMULATOR_OPTS:---seed 1}
+
+make -C "$EMULATOR_DIR" >/dev/null
+gcc -O2 -Wall -I"$MODULE_DIR" -o "$TOOLS/smartlamp_ring" "$TOOLS/smartlamp_ring.c"
+
+modprobe dummy_hcd
+modprobe raw_gadget
+
+"$EMULATOR_DIR/smartlamp-emulator" $EMULATOR_OPTS &
+EMULATOR=$!
+trap 'rmmod smartlamp 2>/dev/null; kill $EMULATOR 2>/dev/null' EXIT
+sleep 1
+
+make -C "$MODULE_DIR" >/dev/null
+modprobe industrialio-triggered-buffer
+insmod "$MODULE_DIR/smartlamp.ko" sample_period_ms=0
+while [ ! -e /sys/kernel/smartlamp/lamp0/stream ]; do sleep 0.2; done
+
+echo "ldr 1000" > /sys/kernel/smartlamp/lamp0/stream
+
+# O resumo é a última linha do stderr; o código de saída já acusa entradas inconsistentes
+if ! RESULT=$("$TOOLS/smartlamp_ring" /dev/smartlamp0 2000 "$DURATION" 2>&1 >/dev/null); then
+    echo "FALHOU: $(echo "$RESULT" | tail -n 1)"
+    exit 1
+fi
+RESULT=$(echo "$RESULT" | tail -n 1)
+LOST=$(echo "$RESULT" | sed -n 's/.*perdidas \([0-9]*\),.*/\1/p')
+
+echo "$RESULT"
+if [ "${LOST:-0}" -eq 0 ]; then
+    echo "FALHOU: o anel nao foi sobrescrito (nenhuma amostra perdida)"
+    exit 1
+fi
+echo OK
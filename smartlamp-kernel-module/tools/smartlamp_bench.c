@@ -0,0 +1,393 @@
+// Benchmark de latência e vazão dos atributos da SmartLamp (sysfs do smartlamp.ko e configfs do
+// smartlamp-configfs.ko).
+//
+// Cada atributo é exercitado por N threads ao mesmo tempo, por um tempo fixo ou por um número fixo de
+// operações, e o resultado sai em texto, JSON ou CSV para comparar execuções. Cada operação é um
+// open()/read() (ou write())/close() completo: o configfs só chama o show() de novo num arquivo novo e
+// assim os dois caminhos são medidos da mesma forma.
+//
+// Para resultados reproduzíveis, rode contra o smartlamp-emulator (veja bench_emulated.sh).
+//
+// Compilação: gcc -O2 -Wall -pthread -o smartlamp_bench smartlamp_bench.c
+// Uso:        ./smartlamp_bench [opções] atributo[=valor] ...   (veja -h)
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/utsname.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_THREADS 256
+#define READ_BUF    256
+
+enum format { FORMAT_TEXT, FORMAT_JSON, FORMAT_CSV };
+
+// Atributo exercitado: leitura ou, com "caminho=valor", escrita do valor
+struct target {
+    const char *spec;
+    char *path;
+    const char *value;
+};
+
+struct worker {
+    pthread_t thread;
+    const struct target *target;
+    uint64_t *latency;          // ns de cada operação medida
+    size_t count, capacity;
+    uint64_t errors, timeouts;
+    int last_errno;
+};
+
+struct result {
+    const struct target *target;
+    uint64_t ops, errors, timeouts;
+    double elapsed, ops_per_sec;
+    double mean_us, p50_us, p95_us, p99_us, max_us;
+    int last_errno;
+};
+
+static unsigned int threads = 4;
+static double duration = 5.0;          // segundos; ignorado se ops_limit != 0
+static uint64_t ops_limit;             // operações por atributo, somando todas as threads
+static uint64_t warmup = 10;           // operações descartadas antes de medir
+static uint64_t timeout_ns = 1000000000ULL;
+
+static uint64_t issued;                // operações já iniciadas (modo ops_limit)
+static uint64_t deadline;
+static int start_flag;
+static pthread_mutex_t start_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t start_cond = PTHREAD_COND_INITIALIZER;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Uma operação completa no atributo; retorna 0 ou -errno
+static int do_op(const struct target *t) {
+    char buf[READ_BUF];
+    ssize_t n;
+    int fd, err = 0;
+
+    fd = open(t->path, t->value ? O_WRONLY : O_RDONLY);
+    if (fd < 0)
+        return -errno;
+
+    if (t->value)
+        n = write(fd, t->value, strlen(t->value));
+    else
+        n = read(fd, buf, sizeof(buf));
+    if (n < 0)
+        err = -errno;
+
+    close(fd);
+    return err;
+}
+
+static void record(struct worker *w, uint64_t ns) {
+    if (w->count == w->capacity) {
+        w->capacity = w->capacity ? w->capacity * 2 : 4096;
+        w->latency = realloc(w->latency, w->capacity * sizeof(*w->latency));
+        if (!w->latency) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    w->latency[w->count++] = ns;
+}
+
+static void *worker_main(void *arg) {
+    struct worker *w = arg;
+
+    // Todas as threads começam juntas
+    pthread_mutex_lock(&start_lock);
+    while (!start_flag)
+        pthread_cond_wait(&start_cond, &start_lock);
+    pthread_mutex_unlock(&start_lock);
+
+    for (;;) {
+        uint64_t t0, t1;
+        int ret;
+
+        if (ops_limit && __atomic_fetch_add(&issued, 1, __ATOMIC_RELAXED) >= ops_limit)
+            break;
+
+        t0 = now_ns();
+        ret = do_op(w->target);
+        t1 = now_ns();
+
+        // Operações com erro também entram na latência: um timeout da USB custa caro e precisa aparecer
+        record(w, t1 - t0);
+        if (ret) {
+            w->errors++;
+            w->last_errno = -ret;
+        }
+        if (t1 - t0 > timeout_ns)
+            w->timeouts++;
+
+        if (!ops_limit && t1 >= deadline)
+            break;
+    }
+    return NULL;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+// Percentil pelo método nearest-rank sobre as latências já ordenadas
+static double percentile_us(const uint64_t *sorted, size_t n, double p) {
+    size_t rank;
+
+    if (!n)
+        return 0;
+    rank = (size_t)(p / 100.0 * n + 0.999999);
+    if (rank < 1)
+        rank = 1;
+    return sorted[(rank > n ? n : rank) - 1] / 1000.0;
+}
+
+static void run_target(const struct target *t, struct result *res) {
+    struct worker workers[MAX_THREADS];
+    uint64_t *all, total = 0, sum = 0, start;
+    size_t n = 0;
+
+    for (uint64_t i = 0; i < warmup; i++)
+        do_op(t);
+
+    memset(workers, 0, sizeof(workers));
+    issued = 0;
+    start_flag = 0;
+    for (unsigned int i = 0; i < threads; i++) {
+        workers[i].target = t;
+        if (pthread_create(&workers[i].thread, NULL, worker_main, &workers[i])) {
+            perror("pthread_create");
+            exit(1);
+        }
+    }
+
+    start = now_ns();
+    deadline = start + (uint64_t)(duration * 1e9);
+    pthread_mutex_lock(&start_lock);
+    start_flag = 1;
+    pthread_cond_broadcast(&start_cond);
+    pthread_mutex_unlock(&start_lock);
+
+    for (unsigned int i = 0; i < threads; i++)
+        pthread_join(workers[i].thread, NULL);
+
+    memset(res, 0, sizeof(*res));
+    res->target = t;
+    res->elapsed = (now_ns() - start) / 1e9;
+
+    for (unsigned int i = 0; i < threads; i++)
+        total += workers[i].count;
+    all = malloc((total ? total : 1) * sizeof(*all));
+    if (!all) {
+        perror("malloc");
+        exit(1);
+    }
+    for (unsigned int i = 0; i < threads; i++) {
+        memcpy(all + n, workers[i].latency, workers[i].count * sizeof(*all));
+        n += workers[i].count;
+        res->errors += workers[i].errors;
+        res->timeouts += workers[i].timeouts;
+        if (workers[i].last_errno)
+            res->last_errno = workers[i].last_errno;
+        free(workers[i].latency);
+    }
+    qsort(all, n, sizeof(*all), cmp_u64);
+    for (size_t i = 0; i < n; i++)
+        sum += all[i];
+
+    res->ops = n;
+    res->ops_per_sec = res->elapsed > 0 ? n / res->elapsed : 0;
+    res->mean_us = n ? sum / 1000.0 / n : 0;
+    res->p50_us = percentile_us(all, n, 50);
+    res->p95_us = percentile_us(all, n, 95);
+    res->p99_us = percentile_us(all, n, 99);
+    res->max_us = n ? all[n - 1] / 1000.0 : 0;
+    free(all);
+}
+
+// ---
+
+// Escreve uma string JSON escapando aspas, barras e caracteres de controle
+static void json_string(FILE *out, const char *s) {
+    fputc('"', out);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\')
+            fprintf(out, "\\%c", *s);
+        else if ((unsigned char)*s < 0x20)
+            fprintf(out, "\\u%04x", *s);
+        else
+            fputc(*s, out);
+    }
+    fputc('"', out);
+}
+
+static void print_text(FILE *out, const struct result *res, int count) {
+    fprintf(out, "%-44s %9s %10s %9s %9s %9s %9s %6s %8s\n", "atributo", "ops", "ops/s",
+            "p50(us)", "p95(us)", "p99(us)", "max(us)", "erros", "timeouts");
+    for (int i = 0; i < count; i++) {
+        const struct result *r = &res[i];
+
+        fprintf(out, "%-44s %9" PRIu64 " %10.1f %9.1f %9.1f %9.1f %9.1f %6" PRIu64 " %8" PRIu64 "\n",
+                r->target->spec, r->ops, r->ops_per_sec, r->p50_us, r->p95_us, r->p99_us, r->max_us,
+                r->errors, r->timeouts);
+        if (r->errors)
+            fprintf(out, "%-44s último erro: %s\n", "", strerror(r->last_errno));
+    }
+}
+
+static void print_json(FILE *out, const struct result *res, int count, const char *label) {
+    struct utsname uts;
+
+    uname(&uts);
+    fprintf(out, "{\n  \"label\": ");
+    json_string(out, label ? label : "");
+    fprintf(out, ",\n  \"timestamp\": %lld,\n  \"kernel\": ", (long long)time(NULL));
+    json_string(out, uts.release);
+    fprintf(out, ",\n  \"threads\": %u,\n  \"duration_s\": %.3f,\n  \"ops_limit\": %" PRIu64
+            ",\n  \"warmup\": %" PRIu64 ",\n  \"timeout_ms\": %" PRIu64 ",\n  \"results\": [\n",
+            threads, ops_limit ? 0 : duration, ops_limit, warmup, timeout_ns / 1000000);
+    for (int i = 0; i < count; i++) {
+        const struct result *r = &res[i];
+
+        fprintf(out, "    {\"attribute\": ");
+        json_string(out, r->target->path);
+        fprintf(out, ", \"op\": \"%s\", \"ops\": %" PRIu64 ", \"elapsed_s\": %.3f, \"ops_per_sec\": %.1f, "
+                "\"mean_us\": %.1f, \"p50_us\": %.1f, \"p95_us\": %.1f, \"p99_us\": %.1f, \"max_us\": %.1f, "
+                "\"errors\": %" PRIu64 ", \"timeouts\": %" PRIu64 "}%s\n",
+                r->target->value ? "write" : "read", r->ops, r->elapsed, r->ops_per_sec, r->mean_us,
+                r->p50_us, r->p95_us, r->p99_us, r->max_us, r->errors, r->timeouts, i + 1 < count ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+}
+
+static void print_csv(FILE *out, const struct result *res, int count, const char *label) {
+    fprintf(out, "label,attribute,op,threads,ops,elapsed_s,ops_per_sec,mean_us,p50_us,p95_us,p99_us,max_us,"
+            "errors,timeouts\n");
+    for (int i = 0; i < count; i++) {
+        const struct result *r = &res[i];
+
+        fprintf(out, "%s,%s,%s,%u,%" PRIu64 ",%.3f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%" PRIu64 ",%" PRIu64 "\n",
+                label ? label : "", r->target->path, r->target->value ? "write" : "read", threads, r->ops,
+                r->elapsed, r->ops_per_sec, r->mean_us, r->p50_us, r->p95_us, r->p99_us, r->max_us,
+                r->errors, r->timeouts);
+    }
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Uso: %s [opções] atributo[=valor] ...\n"
+            "  -t N       threads por atributo (padrão 4)\n"
+            "  -d S       duração em segundos de cada atributo (padrão 5)\n"
+            "  -n N       número de operações por atributo, em vez da duração\n"
+            "  -w N       operações de aquecimento não medidas (padrão 10)\n"
+            "  -T MS      latência acima da qual a operação conta como timeout (padrão 1000)\n"
+            "  -f FORMATO text, json ou csv (padrão text)\n"
+            "  -o ARQUIVO saída (padrão stdout)\n"
+            "  -l RÓTULO  identificação da execução no JSON/CSV\n"
+            "Um atributo com \"=valor\" é exercitado com write(), os demais com read().\n"
+            "Sem atributos, lê led, ldr, temp e hum de /sys/kernel/smartlamp/lamp0.\n", prog);
+}
+
+int main(int argc, char **argv) {
+    static const char *const defaults[] = {
+        "/sys/kernel/smartlamp/lamp0/led", "/sys/kernel/smartlamp/lamp0/ldr",
+        "/sys/kernel/smartlamp/lamp0/temp", "/sys/kernel/smartlamp/lamp0/hum",
+    };
+    enum format format = FORMAT_TEXT;
+    const char *output = NULL, *label = NULL;
+    struct target *targets;
+    struct result *results;
+    FILE *out = stdout;
+    int opt, count;
+
+    while ((opt = getopt(argc, argv, "t:d:n:w:T:f:o:l:h")) != -1) {
+        switch (opt) {
+        case 't': threads = atoi(optarg); break;
+        case 'd': duration = atof(optarg); break;
+        case 'n': ops_limit = strtoull(optarg, NULL, 0); break;
+        case 'w': warmup = strtoull(optarg, NULL, 0); break;
+        case 'T': timeout_ns = strtoull(optarg, NULL, 0) * 1000000ULL; break;
+        case 'f':
+            if (!strcmp(optarg, "text"))
+                format = FORMAT_TEXT;
+            else if (!strcmp(optarg, "json"))
+                format = FORMAT_JSON;
+            else if (!strcmp(optarg, "csv"))
+                format = FORMAT_CSV;
+            else {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'o': output = optarg; break;
+        case 'l': label = optarg; break;
+        default:
+            usage(argv[0]);
+            return opt != 'h';
+        }
+    }
+    if (threads < 1 || threads > MAX_THREADS || (!ops_limit && duration <= 0)) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    count = optind < argc ? argc - optind : (int)(sizeof(defaults) / sizeof(defaults[0]));
+    targets = calloc(count, sizeof(*targets));
+    results = calloc(count, sizeof(*results));
+    if (!targets || !results) {
+        perror("calloc");
+        return 1;
+    }
+    for (int i = 0; i < count; i++) {
+        char *eq;
+
+        targets[i].spec = optind < argc ? argv[optind + i] : defaults[i];
+        targets[i].path = strdup(targets[i].spec);
+        eq = strchr(targets[i].path, '=');
+        if (eq) {
+            *eq = '\0';
+            targets[i].value = eq + 1;
+        }
+        if (access(targets[i].path, targets[i].value ? W_OK : R_OK)) {
+            perror(targets[i].path);
+            return 1;
+        }
+    }
+
+    for (int i = 0; i < count; i++) {
+        fprintf(stderr, "%s: %u threads...\n", targets[i].spec, threads);
+        run_target(&targets[i], &results[i]);
+    }
+
+    if (output) {
+        out = fopen(output, "w");
+        if (!out) {
+            perror(output);
+            return 1;
+        }
+    }
+    if (format == FORMAT_JSON)
+        print_json(out, results, count, label);
+    else if (format == FORMAT_CSV)
+        print_csv(out, results, count, label);
+    else
+        print_text(out, results, count);
+
+    if (out != stdout)
+        fclose(out);
+    return 0;
+}
@@ -0,0 +1,140 @@
+// Leitor de referência do anel de amostras mapeado de /dev/smartlampN.
+// Consome as amostras direto da memória compartilhada com o driver, sem read(), seguindo o protocolo
+// descrito em smartlamp_uapi.h, e confere a consistência de cada entrada (seq igual ao índice).
+//
+// Com uma duração, para depois dela e imprime no stderr quantas amostras leu, perdeu (o produtor deu a volta
+// no anel) e achou inconsistentes; o código de saída é 1 se houve alguma inconsistente (veja ring_overrun.sh).
+//
+// Compilação: gcc -O2 -Wall -I.. -o smartlamp_ring smartlamp_ring.c
+// Uso:        ./smartlamp_ring [/dev/smartlamp0] [intervalo_ms] [duração_s]
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "smartlamp_uapi.h"
+
+#define load_acquire(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+static void sleep_ms(unsigned int ms) {
+    struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
+
+    while (nanosleep(&ts, &ts) && errno == EINTR)
+        ;
+}
+
+// Imprime um campo em centésimos (e.g., 2530 -> 25.30) ou "-" se o sensor não foi lido
+static void print_centi(int32_t value, int valid) {
+    if (!valid)
+        printf(" %8s", "-");
+    else
+        printf(" %s%5d.%02d", value < 0 ? "-" : " ", abs(value / 100), abs(value % 100));
+}
+
+int main(int argc, char **argv) {
+    const char *path = argc > 1 ? argv[1] : "/dev/smartlamp0";
+    unsigned int interval = argc > 2 ? atoi(argv[2]) : 100;
+    unsigned int duration = argc > 3 ? atoi(argv[3]) : 0;
+    const struct smartlamp_ring_header *hdr;
+    const struct smartlamp_sample *data;
+    struct smartlamp_sample sample;
+    uint64_t next, head, tail, lost = 0, bad = 0, got = 0, end;
+    size_t size;
+    void *map;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror(path);
+        return 1;
+    }
+
+    // Mapeia primeiro só o cabeçalho para descobrir o tamanho do anel
+    map = mmap(NULL, sizeof(*hdr), PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+    hdr = map;
+    if (hdr->magic != SMARTLAMP_RING_MAGIC || hdr->version != SMARTLAMP_RING_VERSION ||
+        hdr->entry_size != sizeof(struct smartlamp_sample)) {
+        fprintf(stderr, "%s: formato do anel desconhecido\n", path);
+        return 1;
+    }
+    size = hdr->data_offset + (size_t)hdr->entries * hdr->entry_size;
+    munmap(map, sizeof(*hdr));
+
+    map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+    hdr = map;
+    data = (const void *)((const char *)map + hdr->data_offset);
+
+    // Começa da amostra mais recente já publicada
+    head = load_acquire(&hdr->head);
+    next = head ? head - 1 : 0;
+
+    end = duration ? now_ms() + duration * 1000ULL : 0;
+    printf("%10s %20s %4s %4s %9s %9s\n", "seq", "timestamp_ns", "led", "ldr", "temp", "hum");
+    while (!end || now_ms() < end) {
+        head = load_acquire(&hdr->head);
+        while (next < head) {
+            // O leitor atrasou mais que o tamanho do anel: pula para a amostra mais antiga válida
+            tail = load_acquire(&hdr->tail);
+            if (next < tail) {
+                lost += tail - next;
+                next = tail;
+                continue;
+            }
+
+            memcpy(&sample, &data[next & (hdr->entries - 1)], sizeof(sample));
+
+            // Se tail passou de next durante a cópia, a entrada pode ter sido sobrescrita
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (load_acquire(&hdr->tail) > next)
+                continue;
+
+            if (sample.seq != (uint32_t)next) {
+                bad++;
+                fprintf(stderr, "entrada %" PRIu64 " inconsistente (seq %u)\n", next, sample.seq);
+            }
+
+            printf("%10u %20llu", sample.seq, (unsigned long long)sample.timestamp_ns);
+            if (sample.valid & SMARTLAMP_VALID_LED)
+                printf(" %4d", sample.led);
+            else
+                printf(" %4s", "-");
+            if (sample.valid & SMARTLAMP_VALID_LDR)
+                printf(" %4d", sample.ldr);
+            else
+                printf(" %4s", "-");
+            print_centi(sample.temp, sample.valid & SMARTLAMP_VALID_TEMP);
+            print_centi(sample.hum, sample.valid & SMARTLAMP_VALID_HUM);
+            if (lost || bad)
+                printf("   (perdidas %" PRIu64 ", inconsistentes %" PRIu64 ")", lost, bad);
+            printf("\n");
+            next++;
+            got++;
+        }
+        fflush(stdout);
+        sleep_ms(interval);
+    }
+
+    fprintf(stderr, "lidas %" PRIu64 ", perdidas %" PRIu64 ", inconsistentes %" PRIu64 "\n", got, lost, bad);
+    return bad ? 1 : 0;
+}
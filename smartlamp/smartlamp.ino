@@ -1,4 +1,5 @@
 #include <DHT.h>
+#include <atomic>
 
 // Defina os pinos de LED e LDR
 // Defina uma variável com valor máximo do LDR (4000)
@@ -18,83 +19,1169 @@ int dhtPin = 14;
 #define DHTTYPE DHT11
 DHT dht(dhtPin, DHTTYPE);
 
+// Amostragem em segundo plano: tarefas do FreeRTOS no outro núcleo do ESP32 leem os sensores
+// (o DHT11 leva dezenas de ms com interrupções desligadas) e publicam a última leitura.
+// Os comandos respondem a partir dessa cópia em memória, sem esperar pelos sensores.
+#define SAMPLER_CORE       0     // loop() roda no núcleo 1
+#define SAMPLER_STACK      4096
+#define DHT_PERIOD_MS      2000  // O DHT11 não deve ser lido mais de uma vez a cada 2 s
+
+// LDR: sobreamostrado e decimado em janelas de ldrWindow amostras. Ao fim de cada janela a média,
+// mínimo, máximo e variância são publicados; GET_LDR responde a média da última janela.
+// O pino 25 está no ADC2, que não tem modo contínuo (DMA): por padrão uma tarefa lê o ADC a LDR_SAMPLE_HZ.
+// Com o LDR ligado a um pino do ADC1 (GPIO 32 a 39), LDR_ADC_CONTINUOUS 1 usa o ADC em modo contínuo,
+// com as conversões feitas por DMA e já somadas em grupos de LDR_CONVERSIONS.
+#define LDR_ADC_CONTINUOUS 0
+#define LDR_SAMPLE_HZ      1000  // Amostras por segundo entregues às janelas
+#define LDR_CONVERSIONS    8     // Conversões por amostra no modo contínuo
+#define LDR_WINDOW_DEFAULT 50    // Amostras por janela (50 ms)
+#define LDR_WINDOW_MAX     10000
+
+struct LdrStats {
+  float mean;    // Média da janela (0 a 100)
+  float min;
+  float max;
+  float var;     // Variância da janela (escala de 0 a 100, ao quadrado)
+  int count;     // Amostras na janela
+};
+
+// ldrUs e dhtUs guardam o micros() de cada leitura, para o driver saber quando o valor foi amostrado
+// (e não só quando a resposta chegou) e converter esse instante para o relógio do host.
+struct SensorSnapshot {
+  int ldr;             // Média da última janela do LDR, arredondada (0 a 100)
+  LdrStats ldrStats;
+  float temp;          // NaN se o DHT não respondeu
+  float hum;
+  uint32_t ldrUs;      // micros() do meio da última janela do LDR
+  uint32_t dhtUs;      // micros() da última leitura do DHT
+};
+
+// Seqlock: sensorSeq é ímpar enquanto uma tarefa escreve; quem lê repete se o número mudou durante a cópia.
+// As tarefas do LDR e do DHT escrevem partes diferentes, serializadas por snapshotMux.
+static SensorSnapshot sensorSnapshot = { 0, { 0, 0, 0, 0, 0 }, NAN, NAN, 0, 0 };
+static std::atomic<uint32_t> sensorSeq(0);
+static portMUX_TYPE snapshotMux = portMUX_INITIALIZER_UNLOCKED;
+
+static std::atomic<int> ldrWindow(LDR_WINDOW_DEFAULT);   // Alterado por SET_LDR_WINDOW
+static TaskHandle_t ldrTaskHandle = NULL;
+
+// Protocolo binário (negociado pelo driver com "PROTO BIN"; comandos em texto continuam aceitos).
+// Quadros de tamanho fixo, little-endian, com valores em ponto fixo (temperatura e umidade em centésimos):
+//   sync(0xA5) | len | op | seq | value[4] (int32) | crc16
+// O CRC-16/CCITT (0x8408, init 0xFFFF) cobre de len até value. Deve ser mantido igual ao smartlamp.c.
+#define BIN_SYNC        0xA5
+#define BIN_MAX_VALUES  4
+#define BIN_FRAME_SIZE  (4 + 4 * BIN_MAX_VALUES + 2)
+#define BIN_OP_RESP     0x80
+#define BIN_OP_ERR      0xFF
+#define BIN_INVALID     INT32_MIN
+
+enum {
+  BIN_OP_GET_LED  = 0x01,
+  BIN_OP_SET_LED  = 0x02,
+  BIN_OP_GET_LDR  = 0x03,
+  BIN_OP_GET_TEMP = 0x04,
+  BIN_OP_GET_HUM  = 0x05,
+  BIN_OP_GET_ALL  = 0x06,
+  BIN_OP_GET_LDR_STATS = 0x07,   // Resposta: média, mínimo, máximo e variância em centésimos
+  BIN_OP_SET_LED_RAMP  = 0x08,   // Valores: destino, duração (ms) e curva
+  BIN_OP_LOG_RECORD    = 0x40,   // Registro do DUMP, enviado sem ser pedido (veja logRecordFrame)
+};
+
+// Recepção: os bytes são consumidos um a um assim que chegam, sem bloquear o loop() e sem alocar memória.
+// Uma linha é executada ao chegar o '\n'; um BIN_SYNC no início de uma linha inicia um quadro binário.
+#define RX_LINE_MAX      64   // Tamanho máximo de uma linha de comando (incluindo o '\0')
+#define RX_FRAME_TIMEOUT 50   // Tempo máximo (ms) entre bytes de um quadro antes de descartá-lo
+
+enum RxState {
+  RX_LINE,      // Acumulando uma linha de texto
+  RX_FRAME,     // Acumulando um quadro binário
+  RX_DISCARD,   // Linha longa demais: ignora até o próximo '\n'
+};
+
+static RxState rxState = RX_LINE;
+static char rxLine[RX_LINE_MAX];
+static int rxLen = 0;
+static uint8_t binFrame[BIN_FRAME_SIZE];
+static int frameLen = 0;
+static unsigned long rxLastByte = 0;
+
+// Tabela de comandos em texto. A busca usa uma tabela hash montada no setup(), então o custo de
+// despachar um comando não depende de quantos comandos existem.
+typedef void (*CommandHandler)(const char *args);
+
+struct Command {
+  const char *name;
+  bool hasArgs;             // Comando recebe argumentos (e.g., "SET_LED 80", "PROTO BIN")
+  CommandHandler handler;
+};
+
+void cmdSetLed(const char *args);
+void cmdSetLedRamp(const char *args);
+void cmdGetLed(const char *args);
+void cmdGetLdr(const char *args);
+void cmdGetTemp(const char *args);
+void cmdGetHum(const char *args);
+void cmdGetAll(const char *args);
+void cmdGetAllTs(const char *args);
+void cmdGetLdrStats(const char *args);
+void cmdSetLdrWindow(const char *args);
+void cmdProto(const char *args);
+void cmdStream(const char *args);
+void cmdStop(const char *args);
+void cmdBaud(const char *args);
+void cmdAuto(const char *args);
+void cmdSetAuto(const char *args);
+void cmdGetAuto(const char *args);
+void cmdDump(const char *args);
+
+static const Command commands[] = {
+  { "SET_LED",        true,  cmdSetLed        },
+  { "SET_LED_RAMP",   true,  cmdSetLedRamp    },
+  { "GET_LED",        false, cmdGetLed        },
+  { "GET_LDR",        false, cmdGetLdr        },
+  { "GET_TEMP",       false, cmdGetTemp       },
+  { "GET_HUM",        false, cmdGetHum        },
+  { "GET_ALL",        false, cmdGetAll        },
+  { "GET_ALL_TS",     false, cmdGetAllTs      },
+  { "GET_LDR_STATS",  false, cmdGetLdrStats   },
+  { "SET_LDR_WINDOW", true,  cmdSetLdrWindow  },
+  { "PROTO",          true,  cmdProto         },
+  { "STREAM",         true,  cmdStream        },
+  { "STOP",           false, cmdStop          },
+  { "BAUD",           true,  cmdBaud          },
+  { "AUTO",           true,  cmdAuto          },
+  { "SET_AUTO",       true,  cmdSetAuto       },
+  { "GET_AUTO",       false, cmdGetAuto       },
+  { "DUMP",           true,  cmdDump          },
+};
+#define NUM_COMMANDS (sizeof(commands) / sizeof(commands[0]))
+
+#define CMD_TABLE_SIZE 32   // Potência de 2, maior que NUM_COMMANDS
+static int8_t cmdTable[CMD_TABLE_SIZE];   // Índice em commands[] (-1 = vazio)
+
+// Registro de amostras: a cada LOG_PERIOD_MS o loop() guarda LED, LDR, temperatura e umidade num anel em RAM,
+// de tamanho fixo e sem alocação. O registro continua com o host ausente (cabo removido, host reiniciando) e,
+// ao reconectar, o driver recupera o que perdeu com "DUMP <desde> <máximo> <idade máxima ms>": os registros
+// saem como quadros binários BIN_OP_LOG_RECORD, na velocidade da serial, seguidos de
+// "RES DUMP <enviados> <próximo> <boot>". O anel fica só na RAM: uma queda de energia perde os registros.
+#define LOG_ENTRIES    2048   // Potência de 2: ~34 min a 1 Hz, 32 KB
+#define LOG_PERIOD_MS  1000
+#define LOG_DUMP_BATCH 8      // Registros enviados por volta do loop() durante um DUMP
+#define LOG_INVALID    INT16_MIN
+
+struct LogRecord {
+  uint32_t seq;    // Número do registro desde o boot (começa em 1)
+  uint32_t ms;     // millis() do registro
+  uint8_t led;
+  uint8_t ldr;
+  int16_t temp;    // Centésimos (LOG_INVALID se o DHT não respondeu)
+  int16_t hum;
+};
+
+static LogRecord logRing[LOG_ENTRIES];
+static uint32_t logNextSeq = 1;            // Número do próximo registro
+static unsigned long logNext = 0;          // millis() do próximo registro
+static uint32_t logBoot = 0;               // Aleatório a cada boot: o driver percebe que o ESP32 reiniciou
+
+// DUMP em andamento: os registros saem aos poucos pelo loop(), sem atrasar os outros comandos
+static bool dumpActive = false;
+static uint32_t dumpNext = 0;              // Próximo registro a enviar
+static uint32_t dumpLeft = 0;              // Registros que ainda faltam
+static uint32_t dumpSent = 0;
+static int dumpTag = -1;                   // Tag do DUMP, usada na resposta final
+
+// Modo STREAM: "STREAM <sensor> <Hz>" faz o firmware enviar "STR <sensor> <valor> <micros>" na frequência pedida,
+// sem ser consultado, até receber "STOP". A 9600 baud cabem cerca de 80 linhas por segundo (veja BAUD).
+#define STREAM_MAX_HZ 1000
+
+static const char *const streamNames[] = { "LED", "LDR", "TEMP", "HUM" };
+#define NUM_STREAM_SENSORS (sizeof(streamNames) / sizeof(streamNames[0]))
+
+static int streamSensor = -1;              // Índice em streamNames (-1 desligado)
+static unsigned long streamPeriodUs = 0;   // Intervalo entre amostras
+static unsigned long streamNext = 0;       // micros() da próxima amostra
+
+// Transição do LED: "SET_LED_RAMP <destino> <duração ms> [curva]" faz a transição inteira no firmware,
+// com o PWM atualizado pelo loop() a cada RAMP_STEP_MS, em vez de o host enviar um SET_LED por degrau.
+// A curva RAMP_GAMMA (padrão) percorre o brilho em passos perceptualmente iguais; RAMP_LINEAR, o PWM em passos iguais.
+// GET_LED responde o destino desde o início da transição; um SET_LED no meio dela a interrompe.
+#define RAMP_STEP_MS   4       // ~250 atualizações por segundo
+#define RAMP_MAX_MS    60000
+
+enum RampCurve {
+  RAMP_LINEAR = 0,
+  RAMP_GAMMA  = 1,
+};
+
+// Luminância relativa (CIE 1931) de cada nível de luminosidade percebida de 0 a 100, em 0 a GAMMA_MAX.
+// Calculada pelo compilador: o firmware só consulta a tabela.
+#define GAMMA_MAX 65535u
+
+constexpr double gammaCube(double x) { return x * x * x; }
+constexpr uint16_t gammaEntry(int l) {
+  return (uint16_t)(GAMMA_MAX * (l <= 8 ? l / 903.3 : gammaCube((l + 16) / 116.0)) + 0.5);
+}
+#define GAMMA_ROW(l) gammaEntry(l), gammaEntry(l + 1), gammaEntry(l + 2), gammaEntry(l + 3), gammaEntry(l + 4), \
+                     gammaEntry(l + 5), gammaEntry(l + 6), gammaEntry(l + 7), gammaEntry(l + 8), gammaEntry(l + 9)
+static constexpr uint16_t gammaTable[101] = {
+  GAMMA_ROW(0), GAMMA_ROW(10), GAMMA_ROW(20), GAMMA_ROW(30), GAMMA_ROW(40),
+  GAMMA_ROW(50), GAMMA_ROW(60), GAMMA_ROW(70), GAMMA_ROW(80), GAMMA_ROW(90), gammaEntry(100),
+};
+static_assert(gammaTable[0] == 0 && gammaTable[100] == GAMMA_MAX, "tabela gamma fora da escala");
+
+static bool rampActive = false;
+static int rampFromDuty = 0;               // PWM no início da transição
+static int rampToDuty = 0;                 // PWM no destino (o mesmo do SET_LED)
+static RampCurve rampCurve = RAMP_GAMMA;
+static unsigned long rampStart = 0;        // millis() do início
+static unsigned long rampDurationMs = 0;
+static unsigned long rampNextStep = 0;     // millis() da próxima atualização
+static int ledDuty = 0;                    // PWM atual do LED
+
+// Controle automático da luminosidade: com "AUTO 1" o firmware ajusta o LED a cada janela nova do LDR para manter
+// a média do LDR no setpoint (controlador PI), sem esperar pelo host. O loop() verifica a cada AUTO_POLL_MS se a
+// janela mudou; entre duas janelas a medida é a mesma e não há passo. Uma janela menor (SET_LDR_WINDOW) deixa
+// a medida mais recente e a resposta mais rápida.
+// "SET_AUTO <setpoint> <kp> <ki> <histerese> <mínimo> <máximo>": setpoint e histerese na escala do LDR (0 a 100),
+// ganhos em milésimos (kp em % de LED por % de LDR; ki o mesmo, por segundo) e limites do LED (0 a 100).
+// Com o erro dentro de histerese / 2 a saída fica parada até ele passar de histerese.
+// SET_LED e SET_LED_RAMP desligam o controle.
+#define AUTO_POLL_MS   1
+#define AUTO_GAIN_MAX  1000000   // 1000.000
+
+struct AutoConfig {
+  long setpoint;
+  long kp, ki;         // Milésimos
+  long hyst;
+  long min, max;       // Limites do LED
+};
+
+static AutoConfig autoConfig = { 50, 500, 2000, 2, 0, 100 };
+static bool autoEnabled = false;
+static bool autoSettled = false;           // Erro dentro da histerese: saída mantida
+static float autoIntegral = 0;             // Termo integral, em % de LED
+static float autoOutput = 0;               // Última saída, em % de LED
+static unsigned long autoNext = 0;         // millis() da próxima verificação
+static uint32_t autoLdrUs = 0;             // ldrUs da janela usada no último passo
+
+// Velocidade da serial: inicia em BAUD_DEFAULT e o driver pede uma maior com "BAUD <velocidade>".
+// A resposta sai na velocidade antiga; a nova só vale depois que um comando válido chega por ela.
+// Sem isso em BAUD_CONFIRM_MS o firmware volta para BAUD_DEFAULT (e.g., bridge não acompanhou a troca).
+#define BAUD_DEFAULT    9600
+#define BAUD_CONFIRM_MS 1000
+
+static const long baudRates[] = { 9600, 19200, 38400, 57600, 115200, 230400, 460800, 921600 };
+#define NUM_BAUD_RATES (sizeof(baudRates) / sizeof(baudRates[0]))
+
+static bool baudPending = false;          // Troca ainda não confirmada
+static unsigned long baudChangedAt = 0;   // millis() da troca
+
+// Tag do comando em texto sendo atendido ("#<tag> GET_LDR"), devolvida no início da resposta.
+// -1 quando o comando veio sem tag.
+int responseTag = -1;
+
 // Intensidade inicial (de 0 a 100)
 
 void setup() {
-  Serial.begin(9600);
+  Serial.begin(BAUD_DEFAULT);
   pinMode(ledPin, OUTPUT);
   pinMode(ldrPin, INPUT);
 
   // Inicializa LED com valor normalizado
-  analogWrite(ledPin, normalizeIntensity(ledValue));
+  setLed(ledValue);
+
+  dht.begin();
+  buildCommandTable();
+  logBoot = (esp_random() & 0x7FFFFFFF) | 1;   // Nunca zero e cabe num long do driver
+
+  xTaskCreatePinnedToCore(ldrTask, "ldr", SAMPLER_STACK, NULL, 2, &ldrTaskHandle, SAMPLER_CORE);
+  xTaskCreatePinnedToCore(dhtTask, "dht", SAMPLER_STACK, NULL, 1, NULL, SAMPLER_CORE);
 
   Serial.println("SmartLamp Initialized.");
 }
 
 void loop() {
-  // Lê comando do Monitor Serial (Ctrl + Shift + M)
-  if (Serial.available()) {
-    String command = Serial.readStringUntil('\n');
-    command.trim(); // Remove espaços em branco e quebras de linha
-    processCommand(command);
+  // Consome apenas os bytes já recebidos; comandos do Monitor Serial (Ctrl + Shift + M) também passam por aqui
+  while (Serial.available()) {
+    rxByte(Serial.read());
+  }
+
+  // Quadro incompleto há muito tempo (byte perdido): descarta para voltar a sincronizar
+  if (rxState == RX_FRAME && millis() - rxLastByte > RX_FRAME_TIMEOUT) {
+    rxState = RX_LINE;
+    frameLen = 0;
+  }
+
+  // Troca de velocidade não confirmada: volta para a velocidade inicial
+  if (baudPending && millis() - baudChangedAt > BAUD_CONFIRM_MS) {
+    setBaud(BAUD_DEFAULT);
+  }
+
+  // Depois de uma passagem longa do loop() (e.g., DUMP) só há um passo, com a janela mais recente
+  if (autoEnabled && (long)(millis() - autoNext) >= 0) {
+    autoNext = millis() + AUTO_POLL_MS;
+    autoStep();
+  }
+
+  if (rampActive && (long)(millis() - rampNextStep) >= 0) {
+    rampNextStep += RAMP_STEP_MS;
+    rampStep();
+  }
+
+  if ((long)(millis() - logNext) >= 0) {
+    logNext += LOG_PERIOD_MS;
+    logSample();
+  }
+
+  if (dumpActive) {
+    dumpStep();
+  }
+
+  if (streamSensor >= 0 && (long)(micros() - streamNext) >= 0) {
+    streamNext += streamPeriodUs;
+    // Atrasou mais de um período (e.g., porta serial cheia): retoma a cadência a partir de agora
+    if ((long)(micros() - streamNext) >= 0) {
+      streamNext = micros() + streamPeriodUs;
+    }
+    sendStreamSample();
+  }
+}
+
+// Envia uma amostra do modo STREAM: "STR <sensor> <valor> <micros>", com o micros() em que o valor foi
+// amostrado (o do LED é o atual), para o driver datar a amostra pelo relógio do ESP32.
+void sendStreamSample() {
+  SensorSnapshot s = readSnapshot();
+  uint32_t us = micros();
+
+  Serial.print("STR ");
+  Serial.print(streamNames[streamSensor]);
+  Serial.print(' ');
+  switch (streamSensor) {
+    case 0: Serial.print(ledValue); break;
+    case 1: Serial.print(s.ldr); us = s.ldrUs; break;
+    case 2: Serial.print(s.temp); us = s.dhtUs; break;
+    case 3: Serial.print(s.hum); us = s.dhtUs; break;
+  }
+  Serial.print(' ');
+  Serial.println((unsigned long)us);
+}
+
+// Máquina de estados da recepção: trata um byte e executa o comando quando ele fica completo
+void rxByte(uint8_t c) {
+  rxLastByte = millis();
+
+  switch (rxState) {
+    case RX_FRAME:
+      binFrame[frameLen++] = c;
+      if (frameLen == BIN_FRAME_SIZE) {
+        processFrame(binFrame);
+        rxState = RX_LINE;
+        frameLen = 0;
+      }
+      break;
+
+    case RX_DISCARD:
+      if (c == '\n') {
+        rxState = RX_LINE;
+      }
+      break;
+
+    case RX_LINE:
+      // Quadros binários começam com BIN_SYNC, que nunca aparece em um comando de texto
+      if (rxLen == 0 && c == BIN_SYNC) {
+        binFrame[0] = c;
+        frameLen = 1;
+        rxState = RX_FRAME;
+      } else if (c == '\n') {
+        rxLine[rxLen] = '\0';
+        processLine(rxLine);
+        rxLen = 0;
+      } else if (rxLen >= RX_LINE_MAX - 1) {
+        responseTag = -1;
+        replyLine("ERR Line too long.");
+        rxLen = 0;
+        rxState = RX_DISCARD;
+      } else {
+        rxLine[rxLen++] = c;
+      }
+      break;
+  }
+}
+
+// Monta a tabela hash de comandos (endereçamento aberto com sondagem linear)
+void buildCommandTable() {
+  for (int i = 0; i < CMD_TABLE_SIZE; i++) {
+    cmdTable[i] = -1;
   }
+  for (unsigned int i = 0; i < NUM_COMMANDS; i++) {
+    const char *name = commands[i].name;
+    uint8_t slot = hashName(name, strlen(name));
+    while (cmdTable[slot] >= 0) {
+      slot = (slot + 1) & (CMD_TABLE_SIZE - 1);
+    }
+    cmdTable[slot] = i;
+  }
+}
 
+// FNV-1a reduzido ao tamanho da tabela
+uint8_t hashName(const char *name, int len) {
+  uint32_t hash = 2166136261u;
+  for (int i = 0; i < len; i++) {
+    hash = (hash ^ (uint8_t)name[i]) * 16777619u;
+  }
+  return hash & (CMD_TABLE_SIZE - 1);
+}
 
+// Procura o comando pelo nome (sem '\0' no final); retorna NULL se não existir
+const Command *findCommand(const char *name, int len) {
+  uint8_t slot = hashName(name, len);
+  while (cmdTable[slot] >= 0) {
+    const Command *cmd = &commands[cmdTable[slot]];
+    if (strncmp(cmd->name, name, len) == 0 && cmd->name[len] == '\0') {
+      return cmd;
+    }
+    slot = (slot + 1) & (CMD_TABLE_SIZE - 1);
+  }
+  return NULL;
+}
+
+// Executa uma linha de comando: "[#<tag> ]<COMANDO>[ <argumentos>]"
+void processLine(char *line) {
+  // Remove espaços em branco e quebras de linha das pontas
+  int len = strlen(line);
+  while (len > 0 && isspace((unsigned char)line[len - 1])) {
+    line[--len] = '\0';
+  }
+  while (isspace((unsigned char)*line)) {
+    line++;
+  }
+
+  // Separa a tag opcional: "#12 GET_LDR" -> tag 12, comando "GET_LDR"
+  responseTag = -1;
+  if (line[0] == '#') {
+    char *end = line + 1;
+    long tag;
+    while (isDigit(*end)) {
+      end++;
+    }
+    if (*end == ' ' && parseNumber(line + 1, end, &tag)) {
+      responseTag = tag;
+      line = end + 1;
+    }
+  }
+
+  // Separa o nome do comando dos argumentos
+  char *args = line;
+  while (*args && *args != ' ') {
+    args++;
+  }
+  const Command *cmd = findCommand(line, args - line);
+  if (*args == ' ') {
+    args++;
+  }
+
+  if (cmd && cmd->hasArgs == (*args != '\0')) {
+    baudPending = false;   // Um comando válido confirma a velocidade atual
+    cmd->handler(args);
+  } else {
+    replyLine("ERR Unknown command.");
+  }
 }
 
 // Função para atualizar o valor do LED
-void ledUpdate(String command) {
+void cmdSetLed(const char *args) {
     // Valor deve convertar o valor recebido pelo comando SET_LED para 0 e 255
     // Normalize o valor do LED antes de enviar para a porta correspondente
-    String valueStr = command.substring(8);
-    int value = valueStr.toInt();
+    long value;
 
-    if (isValidNumber(valueStr) && value >= 0 && value <= 100) {
-      ledValue = value;
-      analogWrite(ledPin, normalizeIntensity(ledValue));
-      Serial.println("RES SET_LED 1");
+    if (parseNumber(args, args + strlen(args), &value) && value <= 100) {
+      setLed(value);
+      replyLine("RES SET_LED 1");
     } else {
-      Serial.println("RES SET_LED -1");
+      replyLine("RES SET_LED -1");
     }
 }
 
-// Função para ler o valor do LDR
-int ldrGetValue() {
-    // Leia o sensor LDR e retorne o valor normalizado entre 0 e 100
+// Transição até o destino: "SET_LED_RAMP 80 1000" ou "SET_LED_RAMP 0 500 0" (curva linear)
+void cmdSetLedRamp(const char *args) {
+  const char *duration = strchr(args, ' ');
+  const char *curve = duration ? strchr(duration + 1, ' ') : NULL;
+  const char *end = args + strlen(args);
+  long target, ms, shape = RAMP_GAMMA;
+
+  if (duration && parseNumber(args, duration, &target) &&
+      parseNumber(duration + 1, curve ? curve : end, &ms) &&
+      (!curve || parseNumber(curve + 1, end, &shape)) &&
+      startRamp(target, ms, shape)) {
+    replyLine("RES SET_LED_RAMP 1");
+  } else {
+    replyLine("RES SET_LED_RAMP -1");
+  }
+}
+
+// Ajusta o PWM do LED na hora (interrompe uma transição em andamento e o controle automático)
+void setLed(int value) {
+  rampActive = false;
+  autoEnabled = false;
+  ledValue = value;
+  ledDuty = normalizeIntensity(value);
+  analogWrite(ledPin, ledDuty);
+}
+
+// Valida e inicia uma transição a partir do PWM atual; duração 0 equivale a SET_LED
+bool startRamp(long target, long ms, long curve) {
+  if (target < 0 || target > 100 || ms < 0 || ms > RAMP_MAX_MS || (curve != RAMP_LINEAR && curve != RAMP_GAMMA)) {
+    return false;
+  }
+  if (ms == 0) {
+    setLed(target);
+    return true;
+  }
+
+  autoEnabled = false;
+  ledValue = target;
+  rampFromDuty = ledDuty;
+  rampToDuty = normalizeIntensity(target);
+  rampCurve = (RampCurve)curve;
+  rampStart = millis();
+  rampDurationMs = ms;
+  rampNextStep = rampStart;
+  rampActive = true;
+  return true;
+}
+
+// Atualiza o PWM conforme o tempo decorrido. Na curva gamma o progresso percorre a tabela sempre do
+// lado mais escuro para o mais claro, então subir e descer têm a mesma forma percebida.
+void rampStep() {
+  unsigned long elapsed = millis() - rampStart;
+  int duty;
+
+  if (elapsed >= rampDurationMs) {
+    rampActive = false;
+    duty = rampToDuty;
+  } else if (rampCurve == RAMP_LINEAR) {
+    duty = rampFromDuty + (long)(rampToDuty - rampFromDuty) * (long)elapsed / (long)rampDurationMs;
+  } else {
+    int low = min(rampFromDuty, rampToDuty), high = max(rampFromDuty, rampToDuty);
+    unsigned long pos = (rampToDuty >= rampFromDuty ? elapsed : rampDurationMs - elapsed) * 100;
+    unsigned long index = pos / rampDurationMs, frac = pos % rampDurationMs;
+    uint32_t level = gammaTable[index];
+    if (index < 100) {
+      level += (uint32_t)((uint64_t)(gammaTable[index + 1] - gammaTable[index]) * frac / rampDurationMs);
+    }
+    duty = low + (int)((uint64_t)(high - low) * level / GAMMA_MAX);
+  }
+
+  if (duty != ledDuty) {
+    ledDuty = duty;
+    analogWrite(ledPin, ledDuty);
+  }
+}
+
+// Liga ("AUTO 1") ou desliga ("AUTO 0") o controle automático. Ao ligar, o termo integral parte do brilho
+// atual, então o LED não salta.
+void cmdAuto(const char *args) {
+  long on;
+
+  if (!parseNumber(args, args + strlen(args), &on) || on > 1) {
+    replyLine("RES AUTO -1");
+    return;
+  }
+  if (on && !autoEnabled) {
+    rampActive = false;
+    autoIntegral = autoOutput = ledDuty * 100.0f / 255;
+    autoSettled = false;
+    autoNext = millis();
+    autoLdrUs = readSnapshot().ldrUs;        // O primeiro passo usa a próxima janela
+  }
+  autoEnabled = on;
+  replyLine("RES AUTO 1");
+}
+
+// Configura o controle: "SET_AUTO 50 500 2000 2 0 100" (vale também com o controle ligado)
+void cmdSetAuto(const char *args) {
+  long v[6];
+  AutoConfig c;
+
+  if (parseNumbers(args, v, 6) != 6) {
+    replyLine("RES SET_AUTO -1");
+    return;
+  }
+  c = { v[0], v[1], v[2], v[3], v[4], v[5] };
+  if (c.setpoint > 100 || c.kp > AUTO_GAIN_MAX || c.ki > AUTO_GAIN_MAX || c.hyst > 100 || c.min > c.max || c.max > 100) {
+    replyLine("RES SET_AUTO -1");
+    return;
+  }
+  autoConfig = c;
+  replyLine("RES SET_AUTO 1");
+}
+
+// Estado do controle: RES GET_AUTO <ligado> <setpoint> <kp> <ki> <histerese> <mínimo> <máximo> <ldr> <led> <parado>
+void cmdGetAuto(const char *args) {
+  reply("RES GET_AUTO ");
+  Serial.print(autoEnabled ? 1 : 0);
+  Serial.print(" ");
+  Serial.print(autoConfig.setpoint);
+  Serial.print(" ");
+  Serial.print(autoConfig.kp);
+  Serial.print(" ");
+  Serial.print(autoConfig.ki);
+  Serial.print(" ");
+  Serial.print(autoConfig.hyst);
+  Serial.print(" ");
+  Serial.print(autoConfig.min);
+  Serial.print(" ");
+  Serial.print(autoConfig.max);
+  Serial.print(" ");
+  Serial.print(readSnapshot().ldrStats.mean);
+  Serial.print(" ");
+  Serial.print(autoOutput);
+  Serial.print(" ");
+  Serial.println(autoSettled ? 1 : 0);
+}
+
+// Um passo do controlador PI por janela do LDR, com a duração da janela como dt. O termo integral não cresce
+// enquanto a saída está saturada no sentido do erro (anti-windup), para o LED não demorar a sair do limite
+// quando a luz ambiente muda.
+void autoStep() {
+  SensorSnapshot s = readSnapshot();
+
+  if (s.ldrUs == autoLdrUs) {
+    return;
+  }
+  autoLdrUs = s.ldrUs;
+
+  const float dt = (float)s.ldrStats.count / LDR_SAMPLE_HZ;
+  float error = autoConfig.setpoint - s.ldrStats.mean;
+  float kp = autoConfig.kp / 1000.0f, ki = autoConfig.ki / 1000.0f;
+
+  if (autoSettled ? fabsf(error) > autoConfig.hyst : fabsf(error) <= autoConfig.hyst / 2.0f) {
+    autoSettled = !autoSettled;
+  }
+  if (autoSettled) {
+    return;
+  }
+
+  float integral = autoIntegral + ki * error * dt;
+  float output = kp * error + integral;
+  if (output > autoConfig.max) {
+    output = autoConfig.max;
+    if (error > 0) integral = autoIntegral;
+  } else if (output < autoConfig.min) {
+    output = autoConfig.min;
+    if (error < 0) integral = autoIntegral;
+  }
+  autoIntegral = integral;
+  autoOutput = output;
+
+  int duty = lroundf(output * 255 / 100);
+  ledValue = lroundf(output);
+  if (duty != ledDuty) {
+    ledDuty = duty;
+    analogWrite(ledPin, ledDuty);
+  }
+}
+
+// Converte uma leitura do ADC (ou a média de várias) para a escala de 0 a 100
+float ldrScale(float raw) {
     // faça testes para encontrar o valor maximo do ldr (exemplo: aponte a lanterna do celular para o sensor)
     // Atribua o valor para a variável ldrMax e utilize esse valor para a normalização
-    int  temp = analogRead(ldrPin);
-    ldrValue = map(temp, 0, ldrMax, 0, 100);
-    Serial.print("RES GET_LDR ");
-    Serial.println(ldrValue);
-    return 0;
+    return raw * 100.0f / ldrMax;
 }
 
+// Acumula uma amostra bruta do LDR na janela atual e publica as estatísticas quando ela se completa.
+// Soma e soma dos quadrados em inteiros: sem perda de precisão mesmo em janelas longas.
+void ldrAddSample(int raw) {
+  static int count = 0, minRaw, maxRaw;
+  static uint64_t sum = 0, sumSq = 0;
+  static uint32_t windowStart;
+
+  if (count == 0) windowStart = micros();
+  if (count == 0 || raw < minRaw) minRaw = raw;
+  if (count == 0 || raw > maxRaw) maxRaw = raw;
+  sum += raw;
+  sumSq += (uint64_t)raw * raw;
+  count++;
+
+  if (count >= ldrWindow.load(std::memory_order_relaxed)) {
+    float mean = (float)sum / count;
+    LdrStats stats;
+    stats.mean = ldrScale(mean);
+    stats.min = ldrScale(minRaw);
+    stats.max = ldrScale(maxRaw);
+    // n·Σx² − (Σx)² em inteiros (≤ ~1.7e15 com a janela máxima): sem cancelamento, nunca negativo
+    uint64_t varNum = (uint64_t)count * sumSq - sum * sum;
+    stats.var = ldrScale(ldrScale((float)varNum / ((float)count * count)));
+    stats.count = count;
 
-void processCommand(String command) {
-  // compare o comando com os comandos possíveis e execute a ação correspondente
-  if (command.startsWith("SET_LED ")) {
-      ledUpdate(command);
+    // A média representa o meio da janela
+    uint32_t windowUs = windowStart + ((uint32_t)micros() - windowStart) / 2;
+
+    snapshotWriteBegin();
+    sensorSnapshot.ldrStats = stats;
+    sensorSnapshot.ldr = lroundf(stats.mean);
+    sensorSnapshot.ldrUs = windowUs;
+    ldrValue = sensorSnapshot.ldr;
+    snapshotWriteEnd();
+
+    count = 0;
+    sum = sumSq = 0;
   }
-  else if (command == "GET_LED") {
-    Serial.print("RES GET_LED ");
-    Serial.println(ledValue);
+}
+
+#if LDR_ADC_CONTINUOUS
+// Chamada pelo driver do ADC quando um grupo de conversões está pronto
+void ARDUINO_ISR_ATTR ldrAdcDone() {
+  BaseType_t woken = pdFALSE;
+  vTaskNotifyGiveFromISR(ldrTaskHandle, &woken);
+  portYIELD_FROM_ISR(woken);
+}
+#endif
+
+// Tarefa do LDR: entrega LDR_SAMPLE_HZ amostras por segundo às janelas
+void ldrTask(void *arg) {
+#if LDR_ADC_CONTINUOUS
+  uint8_t pins[] = { (uint8_t)ldrPin };
+  adc_continuous_result_t *result = NULL;
+
+  analogContinuous(pins, 1, LDR_CONVERSIONS, LDR_SAMPLE_HZ * LDR_CONVERSIONS, ldrAdcDone);
+  analogContinuousStart();
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    if (analogContinuousRead(&result, 0)) {
+      ldrAddSample(result[0].avg_read_raw);
+    }
   }
-  else if (command == "GET_LDR") {
-    ldrGetValue();
+#else
+  TickType_t lastWake = xTaskGetTickCount();
+  for (;;) {
+    ldrAddSample(analogRead(ldrPin));
+    vTaskDelayUntil(&lastWake, pdMS_TO_TICKS(1000 / LDR_SAMPLE_HZ));
   }
-  else if (command == "GET_TEMP") {
+#endif
+}
+
+// Tarefa do DHT: lê temperatura e umidade a cada DHT_PERIOD_MS
+void dhtTask(void *arg) {
+  TickType_t lastWake = xTaskGetTickCount();
+  for (;;) {
+    uint32_t start = micros();
     float t = dht.readTemperature();
-    Serial.print("RES GET_TEMP ");
-    Serial.println(t);
-  }
-  else if (command == "GET_HUM") {
     float h = dht.readHumidity();
-    Serial.print("RES GET_HUM ");
-    Serial.println(h);
+    uint32_t us = start + ((uint32_t)micros() - start) / 2;
+
+    snapshotWriteBegin();
+    sensorSnapshot.temp = t;
+    sensorSnapshot.hum = h;
+    sensorSnapshot.dhtUs = us;
+    snapshotWriteEnd();
+
+    vTaskDelayUntil(&lastWake, pdMS_TO_TICKS(DHT_PERIOD_MS));
+  }
+}
+
+// Início e fim de uma escrita no snapshot (seqlock ímpar durante a escrita)
+void snapshotWriteBegin() {
+  portENTER_CRITICAL(&snapshotMux);
+  uint32_t seq = sensorSeq.load(std::memory_order_relaxed);
+  sensorSeq.store(seq + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+}
+
+void snapshotWriteEnd() {
+  sensorSeq.store(sensorSeq.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  portEXIT_CRITICAL(&snapshotMux);
+}
+
+// Obtém a última leitura sem bloquear a tarefa de amostragem
+SensorSnapshot readSnapshot() {
+  SensorSnapshot copy;
+  uint32_t seq;
+  do {
+    seq = sensorSeq.load(std::memory_order_acquire);
+    copy = sensorSnapshot;
+    std::atomic_thread_fence(std::memory_order_acquire);
+  } while ((seq & 1) || seq != sensorSeq.load(std::memory_order_relaxed));
+  return copy;
+}
+
+// Função para ler o valor do LDR
+void cmdGetLdr(const char *args) {
+    reply("RES GET_LDR ");
+    Serial.println(readSnapshot().ldr);
+}
+
+void cmdGetLed(const char *args) {
+  reply("RES GET_LED ");
+  Serial.println(ledValue);
+}
+
+void cmdGetTemp(const char *args) {
+  float t = readSnapshot().temp;
+  reply("RES GET_TEMP ");
+  Serial.println(t);
+}
+
+void cmdGetHum(const char *args) {
+  float h = readSnapshot().hum;
+  reply("RES GET_HUM ");
+  Serial.println(h);
+}
+
+// Negociação de protocolo: apenas "PROTO BIN" é aceito
+void cmdProto(const char *args) {
+  if (strcmp(args, "BIN") == 0) {
+    replyLine("RES PROTO BIN 1");
+  } else {
+    replyLine("ERR Unknown command.");
   }
-  else {
-    Serial.println("ERR Unknown command.");
+}
+
+// Liga o modo STREAM: "STREAM LDR 100"
+void cmdStream(const char *args) {
+  const char *rate = strchr(args, ' ');
+  long hz;
+  int sensor = -1;
+
+  if (rate) {
+    for (unsigned int i = 0; i < NUM_STREAM_SENSORS; i++) {
+      if (strncmp(streamNames[i], args, rate - args) == 0 && streamNames[i][rate - args] == '\0') {
+        sensor = i;
+      }
+    }
+    rate++;
+  }
+
+  if (sensor >= 0 && parseNumber(rate, rate + strlen(rate), &hz) && hz >= 1 && hz <= STREAM_MAX_HZ) {
+    streamSensor = sensor;
+    streamPeriodUs = 1000000UL / hz;
+    streamNext = micros();
+    replyLine("RES STREAM 1");
+  } else {
+    replyLine("RES STREAM -1");
+  }
+}
+
+void cmdStop(const char *args) {
+  streamSensor = -1;
+  replyLine("RES STOP 1");
+}
+
+// Estatísticas da última janela do LDR: RES GET_LDR_STATS <média> <mínimo> <máximo> <variância> <amostras>
+void cmdGetLdrStats(const char *args) {
+  LdrStats stats = readSnapshot().ldrStats;
+
+  reply("RES GET_LDR_STATS ");
+  Serial.print(stats.mean);
+  Serial.print(" ");
+  Serial.print(stats.min);
+  Serial.print(" ");
+  Serial.print(stats.max);
+  Serial.print(" ");
+  Serial.print(stats.var);
+  Serial.print(" ");
+  Serial.println(stats.count);
+}
+
+// Tamanho da janela do LDR em amostras (a LDR_SAMPLE_HZ, e.g., "SET_LDR_WINDOW 100" = 100 ms)
+void cmdSetLdrWindow(const char *args) {
+  long window;
+
+  if (parseNumber(args, args + strlen(args), &window) && window >= 1 && window <= LDR_WINDOW_MAX) {
+    ldrWindow.store(window, std::memory_order_relaxed);
+    replyLine("RES SET_LDR_WINDOW 1");
+  } else {
+    replyLine("RES SET_LDR_WINDOW -1");
+  }
+}
+
+// Troca a velocidade da serial: "BAUD 921600"
+void cmdBaud(const char *args) {
+  long rate;
+  bool valid = false;
+
+  if (parseNumber(args, args + strlen(args), &rate)) {
+    for (unsigned int i = 0; i < NUM_BAUD_RATES; i++) {
+      valid |= (baudRates[i] == rate);
+    }
+  }
+  if (!valid) {
+    replyLine("RES BAUD -1");
+    return;
+  }
+
+  replyLine("RES BAUD 1");
+  setBaud(rate);
+  baudPending = (rate != BAUD_DEFAULT);
+  baudChangedAt = millis();
+}
+
+// Termina de enviar o que está pendente na velocidade atual e troca a velocidade da UART
+void setBaud(long rate) {
+  Serial.flush();
+  Serial.updateBaudRate(rate);
+  rxState = RX_LINE;
+  rxLen = 0;
+  frameLen = 0;
+  baudPending = false;
+}
+
+// Responde todos os sensores numa única linha: RES GET_ALL <led> <ldr> <temp> <hum>
+void cmdGetAll(const char *args) {
+    SensorSnapshot s = readSnapshot();
+
+    reply("RES GET_ALL ");
+    Serial.print(ledValue);
+    Serial.print(" ");
+    Serial.print(s.ldr);
+    Serial.print(" ");
+    Serial.print(s.temp);
+    Serial.print(" ");
+    Serial.println(s.hum);
+}
+
+// GET_ALL com o relógio do ESP32: RES GET_ALL_TS <led> <ldr> <temp> <hum> <agora> <ldr_us> <dht_us>.
+// agora é o micros() da resposta (o driver correlaciona os relógios pelo envio e chegada de cada par) e os
+// demais são os instantes em que o LDR e o DHT foram amostrados. Todos em micros() de 32 bits.
+void cmdGetAllTs(const char *args) {
+    SensorSnapshot s = readSnapshot();
+
+    reply("RES GET_ALL_TS ");
+    Serial.print(ledValue);
+    Serial.print(" ");
+    Serial.print(s.ldr);
+    Serial.print(" ");
+    Serial.print(s.temp);
+    Serial.print(" ");
+    Serial.print(s.hum);
+    Serial.print(" ");
+    Serial.print((uint32_t)micros());
+    Serial.print(" ");
+    Serial.print(s.ldrUs);
+    Serial.print(" ");
+    Serial.println(s.dhtUs);
+}
+
+
+// Guarda a leitura atual no anel de registros (sobrescreve o mais antigo quando cheio)
+void logSample() {
+  SensorSnapshot s = readSnapshot();
+  LogRecord *r = &logRing[logNextSeq & (LOG_ENTRIES - 1)];
+
+  r->seq = logNextSeq++;
+  r->ms = millis();
+  r->led = ledValue;
+  r->ldr = s.ldr;
+  r->temp = toLogCenti(s.temp);
+  r->hum = toLogCenti(s.hum);
+}
+
+int16_t toLogCenti(float value) {
+  int32_t centi = toCenti(value);
+  if (centi == BIN_INVALID) return LOG_INVALID;
+  return max(min(centi, (int32_t)INT16_MAX), (int32_t)INT16_MIN + 1);
+}
+
+// Registro mais antigo ainda no anel
+uint32_t logOldest() {
+  return logNextSeq > LOG_ENTRIES ? logNextSeq - LOG_ENTRIES : 1;
+}
+
+// Recupera os registros: "DUMP <desde> <máximo> <idade máxima ms>" envia até <máximo> registros a partir do
+// número <desde>, pulando os mais velhos que <idade máxima> (0: sem limite). <desde> adiante do último
+// registro (ESP32 reiniciou) recomeça do mais antigo. "DUMP 0 0 0" só informa o próximo número e o boot.
+void cmdDump(const char *args) {
+  long values[3];
+
+  if (parseNumbers(args, values, 3) != 3 || values[1] > LOG_ENTRIES || dumpActive) {
+    replyLine("RES DUMP -1");
+    return;
+  }
+
+  uint32_t next = values[0], maxAge = values[2];
+  if (next < logOldest() || next > logNextSeq) {
+    next = logOldest();
+  }
+  while (maxAge && next < logNextSeq && millis() - logRing[next & (LOG_ENTRIES - 1)].ms > maxAge) {
+    next++;
+  }
+
+  dumpNext = next;
+  dumpLeft = min((uint32_t)values[1], logNextSeq - next);
+  dumpSent = 0;
+  dumpTag = responseTag;
+  dumpActive = true;
+  dumpStep();
+}
+
+// Envia a próxima leva de registros do DUMP e, ao terminar, a resposta
+void dumpStep() {
+  // Registros sobrescritos durante o envio (DUMP muito lento) são pulados
+  if (dumpNext < logOldest()) {
+    uint32_t lost = min(logOldest() - dumpNext, dumpLeft);
+    dumpNext += lost;
+    dumpLeft -= lost;
+  }
+
+  for (int i = 0; i < LOG_DUMP_BATCH && dumpLeft > 0; i++, dumpLeft--, dumpSent++) {
+    logRecordFrame(&logRing[dumpNext++ & (LOG_ENTRIES - 1)]);
+  }
+  if (dumpLeft > 0) {
+    return;
+  }
+
+  dumpActive = false;
+  responseTag = dumpTag;
+  reply("RES DUMP ");
+  Serial.print((unsigned long)dumpSent);
+  Serial.print(" ");
+  Serial.print((unsigned long)dumpNext);
+  Serial.print(" ");
+  Serial.println((unsigned long)logBoot);
+}
+
+// Um registro num quadro binário: número, idade (ms), LED e LDR (um byte cada) e temperatura e umidade
+// (16 bits cada). A idade, em vez do millis(), dispensa o driver de conhecer o relógio do ESP32.
+void logRecordFrame(const LogRecord *r) {
+  int32_t values[BIN_MAX_VALUES];
+
+  values[0] = r->seq;
+  values[1] = millis() - r->ms;
+  values[2] = r->led | (r->ldr << 8);
+  values[3] = (uint16_t)r->temp | ((uint32_t)(uint16_t)r->hum << 16);
+  sendFrame(BIN_OP_LOG_RECORD, 0, values, BIN_MAX_VALUES);
+}
+
+// Inicia uma resposta em texto, precedida pela tag do comando quando ele veio com uma
+void reply(const char *text) {
+  if (responseTag >= 0) {
+    Serial.print('#');
+    Serial.print(responseTag);
+    Serial.print(' ');
+  }
+  Serial.print(text);
+}
+
+// Envia uma resposta em texto completa (com a tag, se houver)
+void replyLine(const char *text) {
+  reply(text);
+  Serial.println();
+}
+
+// CRC-16/CCITT refletido (poly 0x8408), o mesmo do crc_ccitt() do kernel
+uint16_t crc16(const uint8_t *data, int len) {
+  uint16_t crc = 0xFFFF;
+  for (int i = 0; i < len; i++) {
+    crc ^= data[i];
+    for (int b = 0; b < 8; b++) {
+      crc = (crc & 1) ? (crc >> 1) ^ 0x8408 : (crc >> 1);
+    }
+  }
+  return crc;
+}
+
+void putInt32(uint8_t *dst, int32_t value) {
+  dst[0] = value & 0xFF;
+  dst[1] = (value >> 8) & 0xFF;
+  dst[2] = (value >> 16) & 0xFF;
+  dst[3] = (value >> 24) & 0xFF;
+}
+
+int32_t getInt32(const uint8_t *src) {
+  return (int32_t)((uint32_t)src[0] | ((uint32_t)src[1] << 8) | ((uint32_t)src[2] << 16) | ((uint32_t)src[3] << 24));
+}
+
+// Converte uma leitura do DHT para centésimos (NaN vira BIN_INVALID)
+int32_t toCenti(float value) {
+  if (isnan(value)) return BIN_INVALID;
+  return (int32_t)lroundf(value * 100);
+}
+
+// Envia um quadro de resposta com até BIN_MAX_VALUES valores
+void sendFrame(uint8_t op, uint8_t seq, const int32_t *values, int count) {
+  uint8_t frame[BIN_FRAME_SIZE] = {0};
+  frame[0] = BIN_SYNC;
+  frame[1] = count * 4;
+  frame[2] = op;
+  frame[3] = seq;
+  for (int i = 0; i < count; i++) {
+    putInt32(&frame[4 + 4 * i], values[i]);
+  }
+  uint16_t crc = crc16(&frame[1], BIN_FRAME_SIZE - 3);
+  frame[BIN_FRAME_SIZE - 2] = crc & 0xFF;
+  frame[BIN_FRAME_SIZE - 1] = crc >> 8;
+  Serial.write(frame, BIN_FRAME_SIZE);
+}
+
+// Executa um comando recebido em um quadro binário: despacho direto pelo opcode
+void processFrame(const uint8_t *frame) {
+  uint8_t len = frame[1], op = frame[2], seq = frame[3];
+  uint16_t crc = frame[BIN_FRAME_SIZE - 2] | (frame[BIN_FRAME_SIZE - 1] << 8);
+  int32_t values[BIN_MAX_VALUES];
+  SensorSnapshot s;
+  LdrStats stats;
+
+  // Quadro corrompido: descartado sem resposta (o driver detecta pelo timeout)
+  if (crc16(&frame[1], BIN_FRAME_SIZE - 3) != crc || len > 4 * BIN_MAX_VALUES) {
+    return;
+  }
+  baudPending = false;
+
+  switch (op) {
+    case BIN_OP_GET_LED:
+      values[0] = ledValue;
+      sendFrame(op | BIN_OP_RESP, seq, values, 1);
+      break;
+    case BIN_OP_SET_LED:
+      values[0] = -1;
+      if (len >= 4) {
+        int32_t value = getInt32(&frame[4]);
+        if (value >= 0 && value <= 100) {
+          setLed(value);
+          values[0] = 1;
+        }
+      }
+      sendFrame(op | BIN_OP_RESP, seq, values, 1);
+      break;
+    case BIN_OP_SET_LED_RAMP:
+      values[0] = -1;
+      if (len >= 8 && startRamp(getInt32(&frame[4]), getInt32(&frame[8]), len >= 12 ? getInt32(&frame[12]) : RAMP_GAMMA)) {
+        values[0] = 1;
+      }
+      sendFrame(op | BIN_OP_RESP, seq, values, 1);
+      break;
+    case BIN_OP_GET_LDR:
+      values[0] = readSnapshot().ldr;
+      sendFrame(op | BIN_OP_RESP, seq, values, 1);
+      break;
+    case BIN_OP_GET_TEMP:
+      values[0] = toCenti(readSnapshot().temp);
+      sendFrame(op | BIN_OP_RESP, seq, values, 1);
+      break;
+    case BIN_OP_GET_HUM:
+      values[0] = toCenti(readSnapshot().hum);
+      sendFrame(op | BIN_OP_RESP, seq, values, 1);
+      break;
+    case BIN_OP_GET_ALL:
+      values[0] = ledValue;
+      s = readSnapshot();
+      values[1] = s.ldr;
+      values[2] = toCenti(s.temp);
+      values[3] = toCenti(s.hum);
+      sendFrame(op | BIN_OP_RESP, seq, values, 4);
+      break;
+    case BIN_OP_GET_LDR_STATS:
+      stats = readSnapshot().ldrStats;
+      values[0] = toCenti(stats.mean);
+      values[1] = toCenti(stats.min);
+      values[2] = toCenti(stats.max);
+      values[3] = toCenti(stats.var);
+      sendFrame(op | BIN_OP_RESP, seq, values, 4);
+      break;
+    default:
+      sendFrame(BIN_OP_ERR, seq, NULL, 0);
+      break;
   }
 }
 
@@ -103,11 +1190,27 @@ int normalizeIntensity(int val) {
   return map(val, 0, 100, 0, 255);
 }
 
-// Verifica se a string é um número válido
-bool isValidNumber(String str) {
-  if (str.length() == 0) return false;
-  for (int i = 0; i < str.length(); i++) {
-    if (!isDigit(str.charAt(i))) return false;
+// Lê até max números separados por um espaço (e.g., "50 500 2000"); retorna quantos leu ou -1 se algum for inválido
+int parseNumbers(const char *args, long *values, int max) {
+  int count = 0;
+
+  while (*args && count < max) {
+    const char *end = strchr(args, ' ');
+    if (!end) end = args + strlen(args);
+    if (!parseNumber(args, end, &values[count++])) return -1;
+    args = *end ? end + 1 : end;
+  }
+  return *args ? -1 : count;
+}
+
+// Converte os dígitos entre str e end para um número; falha se o trecho estiver vazio,
+// tiver algo além de dígitos ou passar de 9 dígitos
+bool parseNumber(const char *str, const char *end, long *value) {
+  if (str == end || end - str > 9) return false;
+  *value = 0;
+  for (; str < end; str++) {
+    if (!isDigit(*str)) return false;
+    *value = *value * 10 + (*str - '0');
   }
   return true;
 }